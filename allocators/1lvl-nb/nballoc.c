@@ -25,9 +25,13 @@
 * 
 */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <sys/mman.h>
 #include "nb1lvl.h"
 #include "utils.h"
@@ -61,7 +65,10 @@
 #define MASK_CLEAN_OCCUPIED_LEFT    (~MASK_OCCUPY_LEFT )
 #define MASK_CLEAN_OCCUPIED_RIGHT   (~MASK_OCCUPY_RIGHT)
 
-#define ROOT                        (tree[1])
+#define ROOT                        NODE_VAL(h, 1)
+
+// nodes in the top levels have a cache line each, the deeper ones are packed 8 per cache line
+#define NODE_VAL(h, n)              (*((n) < (h)->padded_nodes ? &(h)->tree[n].val : &(h)->packed_tree[(n) - (h)->padded_nodes]))
 
 #define lchild_idx_by_idx(n)        (n << 1)
 #define rchild_idx_by_idx(n)        (lchild_idx_by_idx(n)+1)
@@ -69,38 +76,67 @@
 
 #define is_left_by_idx(n)           (1ULL & (~(n)))
 
+#define offset_by_address(h, ptr)   (((unsigned long long)(ptr)) - (unsigned long long)(h)->overall_memory)
+
+// size must be the one of the allocated block
+#define node_idx_by_address_and_size(h, ptr, size) \
+    (((h)->overall_memory_size + offset_by_address(h, ptr)) >> log2_(size))
+
+// the translation table keeps the level of the node allocated at each leaf
+#ifndef BD_NO_FREE_TREE
+#define node_idx_by_address(h, ptr) \
+    node_idx_by_address_and_size(h, ptr, (h)->overall_memory_size >> ((h)->free_tree[offset_by_address(h, ptr) / (h)->min_size] - 1))
+#else
+#define node_idx_by_address(h, ptr) unsized_release()
+#endif
+
 #define level_by_idx(n)             (1 + (log2_(n)))
 
-#define NUMBER_OF_NODES             ((1 <<  NUM_LEVELS) -1 )
-#define NUMBER_OF_LEAVES            ( 1 << (NUM_LEVELS  -1))
+#define NUMBER_OF_NODES(levels)     ((1ULL <<  (levels)) -1 )
+#define NUMBER_OF_LEAVES(levels)    ( 1ULL << ((levels) -1))
+
+#define MAX_BULK_SPAN               (8ULL)      // at most 2^MAX_BULK_SPAN nodes are claimed together by a bulk allocation
+#define RESIZE_RETRIES              (64U)       // attempts to take a busy left half when a block shrinks in place
 
 
 /***************************************************
- *               NBBS VARIABLES
+ *               NBBS INSTANCE
  **************************************************/
 
-
+struct _nbbs{
+    node* volatile tree;                        // the tree as an implicit binary heap, padded part
+    volatile unsigned long long *packed_tree;   // the tree as an implicit binary heap, packed part
+    unsigned long long padded_nodes;            // nodes with a smaller index are padded
+    unsigned long long tree_size;               // bytes mapped for the tree
+#ifndef BD_NO_FREE_TREE
+    unsigned char* volatile free_tree;          // translation table from leaves to the level of allocated nodes
+#endif
+    void* volatile overall_memory;              // the managed memory region
+    unsigned long long overall_memory_size;
+    unsigned long long number_of_nodes;
+    unsigned long long number_of_leaves;
+    unsigned long long overall_height;
+    unsigned long long max_level;               // last valid allocable level
+    unsigned long long min_size;                // minimum size for allocation
+    unsigned long long max_size;                // maximum size for allocation
+    unsigned long long chunk_size;              // granularity of the scavenger
+    unsigned char *idle;                        // idle[c] tells how long chunk c has been dirty and free, NULL if decommit is off
+    unsigned long long scavenging;              // bumped by the scavenger around each claim, odd while it holds a chunk
 #ifdef BD_SPIN_LOCK
-BD_LOCK_TYPE glock;
+    BD_LOCK_TYPE glock;
 #endif
+    volatile unsigned long long oom __attribute__((aligned(64)));  // deepest level without free nodes (see oom.h), on its own cache line
+};
+
+
+/***************************************************
+ *               NBBS VARIABLES
+ **************************************************/
 
-#ifdef DEBUG
-nbint  *size_allocated;
-unsigned long long *node_allocated;
-#endif
 
 __thread unsigned int tid=-1;
 unsigned int partecipants=0;
 
-static node* volatile tree                      = NULL;
-static node* volatile free_tree                 = NULL;
-static void* volatile overall_memory            = NULL;
-
-static unsigned long long overall_memory_size   = (MIN_ALLOCABLE_BYTES * NUMBER_OF_LEAVES);
-static unsigned long long number_of_nodes       = NUMBER_OF_NODES;
-static unsigned long long number_of_leaves      = NUMBER_OF_LEAVES;
-static unsigned long long overall_height        = NUM_LEVELS;
-static unsigned long long max_level             = 0ULL;
 static volatile int init_phase                  = 0;
 
 
@@ -108,9 +144,52 @@ static volatile int init_phase                  = 0;
  *               NBBS PRIVATE PROCEDURES
  **************************************************/
 
-static void init_tree(unsigned long number_of_nodes);
-static unsigned long long alloc(unsigned long long, unsigned long long);
-static void internal_free_node(unsigned long long n, unsigned long long upper_bound);
+static bool nbbs_init(nbbs *h, unsigned long long levels, unsigned long long min, unsigned long long max, int numa_node);
+static void nbbs_fini(nbbs *h);
+static void init_tree(nbbs *h);
+static unsigned long long alloc(nbbs *h, unsigned long long, unsigned long long);
+static unsigned long long alloc_group(nbbs *h, unsigned long long, unsigned long long, unsigned long long, unsigned long long, unsigned long long*, unsigned long long*);
+static void internal_free_node(nbbs *h, unsigned long long n, unsigned long long upper_bound);
+static void internal_free_group(nbbs *h, unsigned long long *nodes, unsigned long long count, unsigned long long upper_bound);
+static void free_bulk(nbbs *h, void **ptrs, unsigned int count, unsigned long long byte);
+static bool claim_node(nbbs *h, unsigned long long n);
+static void release_node(nbbs *h, unsigned long long n);
+static bool resize_in_place(nbbs *h, void *ptr, unsigned long long byte);
+static inline unsigned int node_state(nbbs *h, unsigned long long n, unsigned long long lvl);
+static inline unsigned long long try_alloc(nbbs *h, unsigned long long n, unsigned long long lvl);
+
+
+/*
+ This function returns the size of the blocks serving a request of the given size.
+ */
+static inline unsigned long long block_size(nbbs *h, unsigned long long byte){
+    byte = upper_power_of_two(byte);
+    return byte < h->min_size ? h->min_size : byte;
+}
+
+#ifdef BD_NO_FREE_TREE
+/*
+ Without the translation table the allocated node can be found only from the size of the block.
+ */
+static unsigned long long unsized_release(){
+    NB_ABORT("Built without free_tree: blocks must be released through the sized API\n");
+    return 0;
+}
+#endif
+
+
+#include "../atomics.h"
+#include "../stats.h"
+#include "../magazine.h"
+#include "../hugepage.h"
+#include "../numa.h"
+#include "../decommit.h"
+#include "../search.h"
+#include "../frag.h"
+#include "../oom.h"
+#include "../backoff.h"
+#include "../arena.h"
+#include "../slab.h"
 
 
 /*******************************************************************
@@ -120,135 +199,493 @@ static void internal_free_node(unsigned long long n, unsigned long long upper_bo
 void __attribute__ ((constructor(500))) premain(){ init(); }
 
 /*
- This function build the Non-Blocking Buddy System.
+ This function build the default Non-Blocking Buddy System.
  */
 void init(){
-    void *tmp_overall_memory;
-    void *tmp_tree;
-    void *tmp_free_tree;
+    unsigned long long min, max, levels;
     bool first = false;
+    nbbs *h = &numa_heap[0];
     
-    if(overall_memory_size < MAX_ALLOCABLE_BYTES) NB_ABORT("No enough levels\n");
-    
-    max_level = overall_height - log2_(MAX_ALLOCABLE_BYTES/MIN_ALLOCABLE_BYTES);        //last valid allocable level
-    
-    if(init_phase ==  0 && __sync_bool_compare_and_swap(&init_phase, 0, 1)){
-
-        tmp_overall_memory = mmap(NULL, overall_memory_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
-
-        if(tmp_overall_memory == MAP_FAILED) 
-            NB_ABORT("No enough levels\n");
-        else if(!__sync_bool_compare_and_swap(&overall_memory, NULL, tmp_overall_memory))
-            munmap(tmp_overall_memory, overall_memory_size);
-            
-        tmp_tree = mmap(NULL,64+(1+number_of_nodes)*sizeof(node), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(NB_LOAD(&init_phase) ==  0 && NB_CAS_RELAXED(&init_phase, 0, 1)){
+        min    = getenv_ull("NBBS_MIN", MIN_ALLOCABLE_BYTES);
+        max    = getenv_ull("NBBS_MAX", MAX_ALLOCABLE_BYTES);
+        levels = getenv_ull("NBBS_NUM_LEVELS", NUM_LEVELS);
         
-        if(tmp_tree == MAP_FAILED)      
-            abort();
-        else if(!__sync_bool_compare_and_swap(&tree, NULL, tmp_tree)) 
-            munmap(tmp_tree, 64+(1+number_of_nodes)*sizeof(node));
-
-        tmp_free_tree = mmap(NULL,64+(number_of_leaves)*sizeof(node), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
-
-        if(tmp_free_tree == MAP_FAILED) 
-            abort();
-        else if(!__sync_bool_compare_and_swap(&free_tree, NULL, tmp_free_tree)) 
-            munmap(tmp_free_tree, 64+(number_of_leaves)*sizeof(node));
-
-#ifdef DEBUG
-    node_allocated = mmap(NULL, sizeof(unsigned long long), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
-    size_allocated = mmap(NULL, sizeof(nbint), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
-      
-    __sync_fetch_and_and(node_allocated,0);
-    __sync_fetch_and_and(size_allocated,0);
-    
-    printf("Debug mode: ON\n");
-#endif
-
-        __sync_bool_compare_and_swap(&tree, NULL, tmp_tree);
-        __sync_bool_compare_and_swap(&free_tree, NULL, tmp_free_tree);
-        __sync_bool_compare_and_swap(&init_phase, 1, 2);
+        hugepage_init();
+        decommit_init();
+        if(!numa_init(levels, min, max)) NB_ABORT("No enough levels\n");
+        arena_init();
+        magazine_init();
+        search_init();
+        backoff_init();
+        slab_init();
+        stats_init();
+        scavenger_start();
+
+        first = true;
+        NB_CAS_RELEASE(&init_phase, 1, 2);
     }
 
-    while(init_phase < 2);
+    while(NB_LOAD_ACQUIRE(&init_phase) < 2);
 
-    if(init_phase == 2) 
-        init_tree(number_of_nodes);
-    else
-        return;
+#ifdef BD_QUIET
+    first = false;
+#endif
 
-    
     if(first){
 #ifdef BD_SPIN_LOCK
-        printf("1lvl-sl: UMA Init complete\n");
+        printf("1lvl-sl: %s Init complete\n", numa_nodes > 1 ? "NUMA" : "UMA");
 #else
-        printf("1lvl-nb: UMA Init complete\n");
+        printf("1lvl-nb: %s Init complete\n", numa_nodes > 1 ? "NUMA" : "UMA");
 #endif
-        printf("\t Total Memory = %lluB, %.0fKB, %.0fMB, %.0fGB\n" , overall_memory_size, overall_memory_size/1024.0, overall_memory_size/1048576.0, overall_memory_size/1073741824.0);
-        printf("\t Levels = %llu\n", overall_height);
-        printf("\t Leaves = %10llu\n", (number_of_nodes+1)/2);
-        printf("\t Nodes  = %10llu\n", number_of_nodes);
-        printf("\t Min size %12lluB, %.0fKB, %.0fMB, %.0fGB at level %llu\n"   , MIN_ALLOCABLE_BYTES, MIN_ALLOCABLE_BYTES/1024.0, MIN_ALLOCABLE_BYTES/1048576.0, MIN_ALLOCABLE_BYTES/1073741824.0, overall_height);
-        printf("\t Max size %12lluB, %.0fKB, %.0fMB, %.0fGB at level %llu\n"   , MAX_ALLOCABLE_BYTES, MAX_ALLOCABLE_BYTES/1024.0, MAX_ALLOCABLE_BYTES/1048576.0, MAX_ALLOCABLE_BYTES/1073741824.0, overall_height - log2_(MAX_ALLOCABLE_BYTES/MIN_ALLOCABLE_BYTES));
-        printf("\t Max allocable level %2llu\n", max_level);
+        if(numa_nodes > 1)
+            printf("\t NUMA instances = %u, %s\n", numa_nodes, numa_bound ? "bound" : "not bound");
+        printf("\t Total Memory = %lluB, %.0fKB, %.0fMB, %.0fGB\n" , h->overall_memory_size, h->overall_memory_size/1024.0, h->overall_memory_size/1048576.0, h->overall_memory_size/1073741824.0);
+        printf("\t Levels = %llu\n", h->overall_height);
+        printf("\t Leaves = %10llu\n", (h->number_of_nodes+1)/2);
+        printf("\t Nodes  = %10llu\n", h->number_of_nodes);
+        printf("\t Min size %12lluB, %.0fKB, %.0fMB, %.0fGB at level %llu\n"   , h->min_size, h->min_size/1024.0, h->min_size/1048576.0, h->min_size/1073741824.0, h->overall_height);
+        printf("\t Max size %12lluB, %.0fKB, %.0fMB, %.0fGB at level %llu\n"   , h->max_size, h->max_size/1024.0, h->max_size/1048576.0, h->max_size/1073741824.0, h->max_level);
+        printf("\t Max allocable level %2llu\n", h->max_level);
+        if(magazine_rounds)
+            printf("\t Magazine = %llu blocks per order\n", magazine_rounds);
+        hugepage_report();
+        if(h->idle != NULL)
+            printf("\t Decommit = blocks of %lluKB or more%s\n", h->chunk_size/1024, scavenge_period ? ", scavenger on" : "");
+        if(search_mode == SEARCH_GUIDED)
+            printf("\t Search = guided\n");
+        if(backoff_policy != BACKOFF_NONE)
+            printf("\t Backoff = %s\n", backoff_names[backoff_policy]);
+        if(slab_mode)
+            printf("\t Slab = blocks of %lluKB\n", slab_bytes(h)/1024);
+        if(arena_limit)
+            printf("\t Arenas = up to %llu more\n", arena_limit);
+        if(stats_mode)
+            printf("\t Stats = on\n");
     }
 }
 
 /*
- This function inits a static tree represented as an implicit binary heap. 
- The first node at index 0 is a dummy node.
+ This function sets up an instance with the given shape and maps its memory.
+ If numa_node is not negative, the memory is bound to that NUMA node.
+ It returns false if the shape is not valid or memory cannot be obtained.
  */
-static void init_tree(unsigned long number_of_nodes){
-    int i=0;
+static bool nbbs_init(nbbs *h, unsigned long long levels, unsigned long long min, unsigned long long max, int numa_node){
+    void *tmp_overall_memory;
+    void *tmp_tree;
+    unsigned long long padded_levels;
+#ifndef BD_NO_FREE_TREE
+    void *tmp_free_tree;
+#endif
+    
+    if(min == 0 || max < min || levels == 0 || levels > 48) return false;
+    
+    min = upper_power_of_two(min);
+    max = upper_power_of_two(max);
+    
+    h->min_size             = min;
+    h->max_size             = max;
+    h->overall_height       = levels;
+    h->number_of_nodes      = NUMBER_OF_NODES(levels);
+    h->number_of_leaves     = NUMBER_OF_LEAVES(levels);
+    h->overall_memory_size  = min * h->number_of_leaves;
+    
+    if(h->overall_memory_size < max) return false;
+    
+    h->max_level = h->overall_height - log2_(max/min);        //last valid allocable level
+    
+    // the top levels, the most contended ones, keep a cache line per node
+    padded_levels = getenv_ull("NBBS_PADDED_LEVELS", PADDED_LEVELS);
+    if(padded_levels > levels) padded_levels = levels;
+    h->padded_nodes = 1ULL << padded_levels;
+    h->tree_size    = 64 + h->padded_nodes*sizeof(node) + (1+h->number_of_nodes-h->padded_nodes)*sizeof(unsigned long long);
+    
+    // aligned to the largest block, so that every block is aligned to its size in the address space too
+    tmp_overall_memory = hugepage_map_aligned(h->overall_memory_size, h->max_size);
+    if(tmp_overall_memory == MAP_FAILED) 
+        return false;
+        
+    tmp_tree = hugepage_map(h->tree_size);
+    if(tmp_tree == MAP_FAILED){
+        hugepage_unmap(tmp_overall_memory, h->overall_memory_size);
+        return false;
+    }
+
+#ifndef BD_NO_FREE_TREE
+    tmp_free_tree = hugepage_map(64+(h->number_of_leaves));
+    if(tmp_free_tree == MAP_FAILED){
+        hugepage_unmap(tmp_overall_memory, h->overall_memory_size);
+        hugepage_unmap(tmp_tree, h->tree_size);
+        return false;
+    }
+    h->free_tree      = tmp_free_tree;
+    if(!numa_bind(tmp_free_tree, 64+(h->number_of_leaves), numa_node)) numa_bound = false;
+#endif
 
-    ROOT.val = 0ULL;
-    for(i=2;i<=number_of_nodes;i++) tree[i].val = 0ULL;
+    // nothing has been touched yet, so every page will come from the node
+    if(!numa_bind(tmp_overall_memory, h->overall_memory_size, numa_node) || !numa_bind(tmp_tree, h->tree_size, numa_node))
+        numa_bound = false;
 
+    h->overall_memory = tmp_overall_memory;
+    h->tree           = tmp_tree;
+    h->packed_tree    = (unsigned long long*) (h->tree + h->padded_nodes);
+    
+    init_tree(h);
+    decommit_setup(h);
+    h->oom = 0;
+    return true;
+}
+
+/*
+ This function inits a static tree represented as an implicit binary heap. 
+ The first node at index 0 is a dummy node.
+ The tree comes from a fresh anonymous mapping, so all its nodes are already free (zero):
+ they are not written here, and their pages are faulted in by the first operations touching them.
+ */
+static void init_tree(nbbs *h){
 #ifdef BD_SPIN_LOCK
   #if BD_SPIN_LOCK == 0
     pthread_mutexattr_t attr;
     pthread_mutexattr_init(&attr);
     pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
-    pthread_mutex_init(&(glock), &attr);
+    pthread_mutex_init(&(h->glock), &attr);
   #else
-    pthread_spin_init(&(glock), PTHREAD_PROCESS_SHARED);
+    pthread_spin_init(&(h->glock), PTHREAD_PROCESS_SHARED);
   #endif
 #endif
 }
 
 /*
- This function destroy the Non-Blocking Buddy System.
+ This function releases the memory of an instance.
+ */
+static void nbbs_fini(nbbs *h){
+    hugepage_unmap(h->overall_memory, h->overall_memory_size);
+#ifndef BD_NO_FREE_TREE
+    hugepage_unmap(h->free_tree, 64+(h->number_of_leaves));
+#endif
+    hugepage_unmap(h->tree, h->tree_size);
+    decommit_fini(h);
+}
+
+/*
+ This function destroy the default Non-Blocking Buddy System.
  */
 void destroy(){
-    free(overall_memory);
-    free(free_tree);
-    free(tree);
+    unsigned int i;
+    for(i = 0; i < numa_instances; i++){
+        nbbs_fini(numa_slot[i]);
+        if(i >= numa_nodes) munmap(numa_slot[i], sizeof(numa_arena));
+    }
+}
+
+
+/*******************************************************************
+ *               NBBS INSTANCES
+ ******************************************************************/
+
+/*
+ API for creating an instance managing size bytes, from which blocks between min and max bytes can be allocated.
+ Sizes are rounded to powers of two. It returns NULL if the shape is not valid.
+ */
+nbbs* nbbs_create(size_t size, size_t min, size_t max){
+    nbbs *h;
+    
+    if(min == 0 || size < min) return NULL;
+    
+    h = mmap(NULL, sizeof(nbbs), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(h == MAP_FAILED) return NULL;
+    
+    if(!nbbs_init(h, 1 + log2_(size/upper_power_of_two(min)), min, max, -1)){
+        munmap(h, sizeof(nbbs));
+        return NULL;
+    }
+    return h;
+}
+
+/*
+ API for destroying an instance. Every block allocated from it becomes invalid.
+ */
+void nbbs_destroy(nbbs *h){
+    if(h == NULL || numa_is_default(h)) return;
+    nbbs_fini(h);
+    munmap(h, sizeof(nbbs));
+}
+
+/*
+ API for getting the instance used by bd_xx_malloc/bd_xx_free on the NUMA node of the calling thread.
+ */
+nbbs* nbbs_default(){
+    return &numa_heap[numa_local()];
+}
+
+/*
+ API for the memory footprint of an instance: committed is the part of the managed memory backed by
+ physical pages, reserved is the size of the managed memory. Either pointer can be NULL.
+ */
+void nbbs_footprint(nbbs *h, size_t *committed, size_t *reserved){
+    if(committed) *committed = decommit_resident(h->overall_memory, h->overall_memory_size);
+    if(reserved)  *reserved  = h->overall_memory_size;
+}
+
+/*
+ API for the memory footprint of the instances behind bd_xx_malloc/bd_xx_free.
+ */
+void bd_xx_footprint(size_t *committed, size_t *reserved){
+    size_t c = 0, r = 0, tc, tr;
+    unsigned int i;
+
+    for(i = 0; i < NB_LOAD_ACQUIRE(&numa_instances); i++){
+        nbbs_footprint(numa_slot[i], &tc, &tr);
+        c += tc;
+        r += tr;
+    }
+    if(committed) *committed = c;
+    if(reserved)  *reserved  = r;
+}
+
+/*
+ API for the statistics: the counters of all the threads, summed while they keep running.
+ */
+void nbbs_stats(struct nbbs_stats *stats){
+    stats_merge(stats);
+}
+
+/*
+ API for the free space of an instance: frag gets the free blocks by order and the fragmentation index,
+ largest[i] the order of the largest free block below the i-th node at max_level. The walk goes down to level
+ depth (0 for the whole tree) and does not stop the threads, so the result is approximate, see ../frag.h.
+ It returns the number of nodes at max_level.
+ */
+unsigned long long nbbs_frag(nbbs *h, struct nbbs_frag *frag, unsigned long long depth, unsigned char *largest, unsigned long long count){
+    unsigned long long roots;
+
+    memset(frag, 0, sizeof(*frag));
+    roots = frag_walk(h, frag, depth, largest, count);
+    frag_index(frag, h->max_size);
+    return roots;
+}
+
+/*
+ API for the free space of the instances behind bd_xx_malloc/bd_xx_free, walked down to level depth as by nbbs_frag.
+ */
+void bd_xx_frag(struct nbbs_frag *frag, unsigned long long depth){
+    unsigned int i;
+
+    memset(frag, 0, sizeof(*frag));
+    for(i = 0; i < NB_LOAD_ACQUIRE(&numa_instances); i++)
+        frag_walk(numa_slot[i], frag, depth, NULL, 0);
+    frag_index(frag, numa_heap[0].max_size);
+}
+
+/*
+ API for the size of an allocated block, as malloc_usable_size: it returns the bytes of the block at address n,
+ or 0 if n is not in the managed memory of the instance.
+ */
+size_t nbbs_usable_size(nbbs *h, void* n){
+    if((char*) n < (char*) h->overall_memory || (char*) n >= (char*) h->overall_memory + h->overall_memory_size) return 0;
+    if(slab_object(h, n)) return slab_object_size(h, n);
+    return h->overall_memory_size >> (level_by_idx(node_idx_by_address(h, n)) - 1);
+}
+
+/*
+ API for the size of a block taken with bd_xx_malloc, 0 if n does not come from the instances behind it.
+ */
+size_t bd_xx_usable_size(void* n){
+    nbbs *h = numa_heap_by_address(n);
+
+    return h == NULL ? 0 : nbbs_usable_size(h, n);
 }
 
 /*
- API for memory allocation.
+ API for memory allocation. The instance of the local NUMA node is tried first, then the other ones by distance,
+ then the arenas; when all of them fail the heap grows by an arena, if it can.
  */
 void* bd_xx_malloc(size_t byte){
+    unsigned int local = numa_local(), i;
+    unsigned long long seen;
+    nbbs *h;
+    void *p;
+
+    do{
+        seen = arena_epoch();
+        for(i = 0; i < NB_LOAD_ACQUIRE(&numa_instances); i++){
+            h = numa_instance(local, i);
+            if(arena_skip(h)) continue;
+            if(slab_serves(h, byte))    p = slab_malloc(h, byte);
+            else if(magazine_rounds)    p = magazine_malloc(h, byte);
+            else                        p = nbbs_malloc(h, byte);
+            if(p != NULL){
+                arena_taken(h, 1);
+                return p;
+            }
+        }
+    }while(arena_grow(seen, byte));
+    return NULL;
+}
+
+/*
+ API for aligned memory allocation, with the semantics of aligned_alloc. align has to be a power of two
+ not larger than the largest block; the block can be released with bd_xx_free.
+ */
+void* bd_xx_aligned_alloc(size_t align, size_t byte){
+    if(align == 0 || (align & (align - 1)) != 0) return NULL;
+    return bd_xx_malloc(byte < align ? align : byte);
+}
+
+/*
+ API for memory reallocation, with the semantics of realloc. The block is resized in place when possible,
+ otherwise it is moved to a block taken as by bd_xx_malloc.
+ */
+void* bd_xx_realloc(void* n, size_t byte){
+    unsigned long long old_size;
+    nbbs *h;
+    void *p;
+
+    if(n == NULL) return bd_xx_malloc(byte);
+    if(byte == 0){
+        bd_xx_free(n);
+        return NULL;
+    }
+
+    h = numa_heap_by_address(n);
+    if(h == NULL || byte > h->max_size) return NULL;
+
+    if(slab_object(h, n)){
+        // an object stays where it is as long as its class does not change
+        old_size = slab_object_size(h, n);
+        if(slab_serves(h, byte) && slab_class(byte) == slab_class(old_size)) return n;
+    }
+    else{
+        // a block shrinking to the size of an object becomes one, as the sized release expects
+        old_size = h->overall_memory_size >> (level_by_idx(node_idx_by_address(h, n)) - 1);
+        if(!slab_serves(h, byte) && resize_in_place(h, n, byte)) return n;
+    }
+
+    p = bd_xx_malloc(byte);
+    if(p != NULL){
+        memcpy(p, n, old_size < byte ? old_size : byte);
+        bd_xx_free(n);
+    }
+    return p;
+}
+
+/*
+ API for memory release. The block goes back to the instance it was taken from.
+ */
+void bd_xx_free(void* n){
+    nbbs *h;
+
+    // NULL and the addresses the heap does not own are ignored
+    if(n == NULL || (h = numa_heap_by_address(n)) == NULL) return;
+
+    if(slab_object(h, n))       slab_free(h, n);
+    else if(magazine_rounds)    magazine_free(h, n, level_by_idx(node_idx_by_address(h, n)));
+    else                        nbbs_free(h, n);
+    arena_given(h, 1);
+}
+
+/*
+ API for bulk memory allocation. Blocks missing on the local NUMA node are taken from the other ones by distance.
+ */
+unsigned int bd_xx_malloc_bulk(size_t byte, unsigned int count, void **out){
+    unsigned int local = numa_local(), got = 0, i, k;
+    unsigned long long seen;
+    nbbs *h;
+
+    // objects of a slab are taken one at a time, so that the sized release finds them by their size
+    if(slab_serves(&numa_heap[0], byte)){
+        while(got < count && (out[got] = bd_xx_malloc(byte)) != NULL) got++;
+        return got;
+    }
+
+    do{
+        seen = arena_epoch();
+        for(i = 0; i < NB_LOAD_ACQUIRE(&numa_instances) && got < count; i++){
+            h = numa_instance(local, i);
+            if(arena_skip(h)) continue;
+            k = nbbs_malloc_bulk(h, byte, count - got, out + got);
+            arena_taken(h, k);
+            got += k;
+        }
+    }while(got < count && arena_grow(seen, byte));
+    return got;
+}
+
+/*
+ API for memory release when the size of the block is known.
+ */
+void bd_xx_free_sized(void* n, size_t byte){
+    nbbs *h;
+
+    // NULL and the addresses the heap does not own are ignored
+    if(n == NULL || (h = numa_heap_by_address(n)) == NULL) return;
+
+    if(slab_serves(h, byte))    slab_free(h, n);
+    else if(magazine_rounds)    magazine_free(h, n, level_by_idx(h->overall_memory_size / block_size(h, byte)));
+    else                        nbbs_free_sized(h, n, byte);
+    arena_given(h, 1);
+}
+
+/*
+ API for bulk memory release.
+ */
+void bd_xx_free_bulk(void **ptrs, unsigned int count){
+    if(slab_mode)   slab_free_bulk(ptrs, count, 0);
+    else            numa_free_bulk(ptrs, count, 0);
+    arena_given_bulk(ptrs, count);
+}
+
+/*
+ API for bulk memory release of blocks with the same known size.
+ */
+void bd_xx_free_bulk_sized(void **ptrs, unsigned int count, size_t byte){
+    if(slab_mode)   slab_free_bulk(ptrs, count, byte);
+    else            numa_free_bulk(ptrs, count, byte);
+    arena_given_bulk(ptrs, count);
+}
+
+/*
+ This function completes the allocation of the node n, out of the starting_node nodes of blocks of byte bytes,
+ and returns the address of its block.
+ */
+static inline void* allocated_block(nbbs *h, unsigned long long n, unsigned long long starting_node, unsigned long long byte){
+    // get the position of the minimum-index leaf in the allocated block
+    unsigned long long leaf_position = byte*(n - starting_node)/h->min_size;
+    
+    stats_alloc(byte, 1);
+
+    // set up translation table
+  #ifndef BD_NO_FREE_TREE
+    h->free_tree[leaf_position] = level_by_idx(n);
+  #endif
+    // populate cache assuming that the nest node will be free
+    update_freemap(level_by_idx(n), starting_node+((n+1)%starting_node));
+    return ((char*) h->overall_memory) + leaf_position*h->min_size;
+}
+
+/*
+ API for memory allocation on a given instance.
+ */
+void* nbbs_malloc(nbbs *h, size_t byte){
     unsigned long long starting_node, last_node, actual, started_at, failed_at_node;
-    unsigned long long leaf_position;
-    unsigned long long searched_lvl = 0;
+    unsigned long long searched_lvl = 0, seen;
     bool restarted = false;
 
     // just on startup 
     if(tid == -1)  
-        tid = __sync_fetch_and_add(&partecipants, 1);
+        tid = NB_FETCH_ADD(&partecipants, 1);
 
     // check memory request size
-    if( byte > MAX_ALLOCABLE_BYTES || byte > overall_memory_size)   
+    if( byte > h->max_size || byte > h->overall_memory_size)   
         return NULL;  
 
     // round to a proper size
     byte = upper_power_of_two(byte);
-    if( byte < MIN_ALLOCABLE_BYTES ) 
-        byte = MIN_ALLOCABLE_BYTES;
+    if( byte < h->min_size ) 
+        byte = h->min_size;
 
     // first node for this level
-    starting_node  = overall_memory_size / byte;
+    starting_node  = h->overall_memory_size / byte;
     
     // last node for this level
     last_node      = lchild_idx_by_idx(starting_node)-1;
@@ -256,48 +693,282 @@ void* bd_xx_malloc(size_t byte){
     // get the target level
     searched_lvl   = level_by_idx(starting_node);
 
+    // no free node is left at this level
+    if(oom_exhausted(h, searched_lvl)){
+        stats_failure(byte, 1);
+        return NULL;
+    }
+
     // check local cache level
     actual         = get_freemap(searched_lvl, last_node);
-    if(!actual)    actual = started_at = starting_node + (tid) * ((last_node - starting_node + 1)/partecipants);
+    if(!actual)    actual = started_at = starting_node + (tid) * ((last_node - starting_node + 1)/NB_LOAD(&partecipants));
     
     // start index
     started_at = actual;
-    
+    seen       = scavenge_seen(h);
+
+    // the level is scanned again if a chunk held by the scavenger may have been in the way
     do{
-        // try to allocate the target node 
-        // uses locks in the blocking version 
-        BD_LOCK(&glock);
-        failed_at_node = alloc(actual, searched_lvl);
-        BD_UNLOCK(&glock);
- 
-        // successful allocation
-        if(failed_at_node == 0){
-            
-          #ifdef DEBUG
-            __sync_fetch_and_add(node_allocated,1);
-            __sync_fetch_and_add(size_allocated,byte);
-          #endif
-            // get the position of the minimum-index leaf in the allocated block
-            leaf_position = byte*(actual - overall_memory_size / byte)/MIN_ALLOCABLE_BYTES;
-            // set up translation table
-            free_tree[leaf_position].val = actual;
-            // populate cache assuming that the nest node will be free
-            update_freemap(searched_lvl, starting_node+((actual+1)%starting_node));
-            return ((char*) overall_memory) + leaf_position*MIN_ALLOCABLE_BYTES;
+        // descend from the roots following the occupancy bits
+        if(search_mode == SEARCH_GUIDED){
+            actual = guided_search(h, started_at, searched_lvl);
+            if(actual != 0) return allocated_block(h, actual, starting_node, byte);
+            continue;
         }
+
+        actual    = started_at;
+        restarted = false;
+        do{
+            // try to allocate the target node 
+            // uses locks in the blocking version 
+            STATS_ADD(attempts, 1);
+            BD_LOCK(&h->glock);
+            failed_at_node = alloc(h, actual, searched_lvl);
+            BD_UNLOCK(&h->glock);
+     
+            // successful allocation
+            if(failed_at_node == 0) return allocated_block(h, actual, starting_node, byte);
+            
+            // failed while fragmenting a higher-order node so skip nodes surely occupied 
+            actual = (failed_at_node + 1) * (1ULL << (      searched_lvl - level_by_idx(failed_at_node)));
+            
+            // the last node of the target level has been reached restart from the first node 
+            // (unless a skip has already crossed the starting point after a restart)
+            if(actual > last_node){
+                if(restarted) break;
+                actual = starting_node;
+                restarted = true;
+            }
+            // all nodes have been checked
+        }while(restarted == false || actual < started_at);
+    }while(scavenge_raced(h, &seen));
+
+    oom_record(h, searched_lvl);
+    stats_failure(byte, 1);
+    return NULL;
+}
+
+
+/*
+ API for aligned memory allocation on a given instance. align has to be a power of two.
+ A block is aligned to its size, so the smallest block of at least align and byte bytes is allocated:
+ a sized release has to be given that size.
+ */
+void* nbbs_aligned_alloc(nbbs *h, size_t align, size_t byte){
+    if(align == 0 || (align & (align - 1)) != 0) return NULL;
+    return nbbs_malloc(h, byte < align ? align : byte);
+}
+
+/*
+ API for memory reallocation on a given instance, with the semantics of realloc.
+ The block is resized in place when possible, otherwise it is moved to a new block of the instance.
+ */
+void* nbbs_realloc(nbbs *h, void* n, size_t byte){
+    unsigned long long old_size;
+    void *p;
+
+    if(n == NULL) return nbbs_malloc(h, byte);
+    if(byte == 0){
+        nbbs_free(h, n);
+        return NULL;
+    }
+    if(byte > h->max_size) return NULL;
+
+    old_size = h->overall_memory_size >> (level_by_idx(node_idx_by_address(h, n)) - 1);
+    if(resize_in_place(h, n, byte)) return n;
+
+    p = nbbs_malloc(h, byte);
+    if(p != NULL){
+        memcpy(p, n, old_size < byte ? old_size : byte);
+        nbbs_free(h, n);
+    }
+    return p;
+}
+
+
+/*
+ API for bulk memory allocation on a given instance.
+ It allocates up to count blocks of the same size, storing them in out, and returns how many blocks have been allocated.
+ Nodes are claimed in groups of siblings and cousins, so that their common ancestors are updated once per group.
+ */
+unsigned int nbbs_malloc_bulk(nbbs *h, size_t byte, unsigned int count, void **out){
+    unsigned long long claimed[1ULL << MAX_BULK_SPAN];
+    unsigned long long starting_node, last_node, actual, started_at, failed_at_node;
+    unsigned long long leaf_position, group, span, i, c, seen;
+    unsigned long long searched_lvl = 0;
+    unsigned int got = 0;
+    bool restarted = false;
+
+    // just on startup 
+    if(tid == -1)  
+        tid = NB_FETCH_ADD(&partecipants, 1);
+
+    // check memory request size
+    if( count == 0 || byte > h->max_size || byte > h->overall_memory_size)   
+        return 0;  
+
+    // round to a proper size
+    byte = upper_power_of_two(byte);
+    if( byte < h->min_size ) 
+        byte = h->min_size;
+
+    starting_node  = h->overall_memory_size / byte;
+    last_node      = lchild_idx_by_idx(starting_node)-1;
+    searched_lvl   = level_by_idx(starting_node);
+
+    if(oom_exhausted(h, searched_lvl)){
+        stats_failure(byte, count);
+        return 0;
+    }
+
+    // check local cache level
+    actual         = get_freemap(searched_lvl, last_node);
+    if(!actual)    actual = starting_node + (tid) * ((last_node - starting_node + 1)/NB_LOAD(&partecipants));
+    
+    // start index
+    started_at = actual;
+    seen       = scavenge_seen(h);
+    
+    // the level is scanned again if a chunk held by the scavenger may have been in the way
+    do{
+        actual    = started_at;
+        restarted = false;
+        do{
+            // the group is rooted span levels above the target level and covers the remaining requests
+            span = log2_(upper_power_of_two(count - got));
+            if(span > MAX_BULK_SPAN)                span = MAX_BULK_SPAN;
+            if(span > searched_lvl - h->max_level)  span = searched_lvl - h->max_level;
+            group = actual >> span;
+
+            STATS_ADD(attempts, 1);
+            BD_LOCK(&h->glock);
+            c = alloc_group(h, group, span, searched_lvl, count - got, claimed, &failed_at_node);
+            BD_UNLOCK(&h->glock);
+
+            for(i=0;i<c;i++){
+                leaf_position = byte*(claimed[i] - starting_node)/h->min_size;
+              #ifndef BD_NO_FREE_TREE
+                h->free_tree[leaf_position] = searched_lvl;
+              #endif
+                out[got++] = ((char*) h->overall_memory) + leaf_position*h->min_size;
+            }
+            if(c != 0) stats_alloc(byte, c);
+
+            if(got == count){
+                update_freemap(searched_lvl, starting_node+((claimed[c-1]+1)%starting_node));
+                return got;
+            }
         
-        // failed while fragmenting a higher-order node so skip nodes surely occupied 
-        actual = (failed_at_node + 1) * (1 << (        searched_lvl - level_by_idx(failed_at_node)));
+            // skip the subtree of an occupied ancestor of the group, otherwise go to the next group
+            if(failed_at_node != 0 && level_by_idx(failed_at_node) < level_by_idx(group))
+                actual = (failed_at_node + 1) * (1ULL << (searched_lvl - level_by_idx(failed_at_node)));
+            else
+                actual = (group + 1) << span;
         
-        // the last node of the target level has been reached restart from the first node 
-        if(actual > last_node){
-            actual = starting_node;
-            restarted = true;
-        }
-        // all nodes have been checked
-    }while(restarted == false || actual < started_at);
+            if(actual > last_node){
+                if(restarted) break;
+                actual = starting_node;
+                restarted = true;
+            }
+        }while(restarted == false || actual < started_at);
+    }while(scavenge_raced(h, &seen));
+
+    oom_record(h, searched_lvl);
+    stats_failure(byte, count - got);
+    return got;
+}
+
+
+/*
+ This routine implements the allocation of a group of nodes at level lvl which descend from the node a, span levels above.
+ It claims up to want free nodes, then it marks their ancestors level by level: 
+ the nodes sharing a parent are merged, so that each ancestor is updated with a single CAS for the whole group.
+ The nodes below an occupied ancestor are rolled back and dropped from the group.
+ This routine returns the number of nodes stored in claimed. 
+ If the whole group fails, failed_at_node is set to the index of the node that made the allocation fail.
+ */
+static unsigned long long alloc_group(nbbs *h, unsigned long long a, unsigned long long span, unsigned long long lvl, unsigned long long want, unsigned long long *claimed, unsigned long long *failed_at_node){
+    unsigned long long nodes[1ULL << MAX_BULK_SPAN];
+    unsigned long long actual_value, new_value, occupy_bits, coalesce_bits;
+    unsigned long long actual, i, j, k, kept, c = 0, nn;
+    unsigned int retries;
+    unsigned long long first = a << span;
+    unsigned long long last  = first + (1ULL << span);
     
-    return NULL;
+    *failed_at_node = 0;
+    
+    // the root of the group is already allocated
+    if((NB_LOAD(&NODE_VAL(h, a)) & OCCUPY) != 0){
+        *failed_at_node = a;
+        return 0;
+    }
+    
+    // try to allocate the target nodes
+    for(i=first; i<last && c<want; i++)
+        if(NB_LOAD(&NODE_VAL(h, i)) == 0 && NB_CAS_ACQUIRE(&NODE_VAL(h, i),0,OCCUPY_BLOCK))
+            claimed[c++] = i;
+    
+    if(c == 0) return 0;
+    
+    for(i=0;i<c;i++) nodes[i] = claimed[i];
+    nn = c;
+    
+    while(lvl != h->max_level){
+        
+        // parent nodes
+        lvl--;
+        
+        for(i=0, j=0; i<nn; ){
+            actual = parent_idx_by_idx(nodes[i]);
+            occupy_bits = coalesce_bits = 0;
+            
+            // merge the bits of the children sharing this parent
+            do{
+                if(is_left_by_idx(nodes[i])){ occupy_bits |= MASK_OCCUPY_LEFT;  coalesce_bits |= MASK_LEFT_COALESCE;  }
+                else                        { occupy_bits |= MASK_OCCUPY_RIGHT; coalesce_bits |= MASK_RIGHT_COALESCE; }
+                i++;
+            }while(i<nn && parent_idx_by_idx(nodes[i]) == actual);
+            
+            // retry loop for fragmenting it
+            retries = 0;
+            do{
+                BACKOFF_RETRY(retries);
+                actual_value = NB_LOAD_ACQUIRE(&NODE_VAL(h, actual));
+                
+                // check if parent has been fully occupied
+                if((actual_value & OCCUPY)!=0) break;
+                
+                new_value = (actual_value & ~coalesce_bits) | occupy_bits;
+                
+                #ifdef BD_SPIN_LOCK  
+                    NB_STORE(&NODE_VAL(h, actual), new_value);
+                    actual_value = new_value;
+                #endif
+            }while(new_value != actual_value && 
+                    !NB_CAS_ACQUIRE(&NODE_VAL(h, actual), actual_value, new_value));
+            
+            if((actual_value & OCCUPY)==0){
+                nodes[j++] = actual;
+                continue;
+            }
+            
+            // rollback the nodes below the occupied parent
+            for(k=0, kept=0; k<c; k++){
+                if((claimed[k] >> (level_by_idx(claimed[k]) - lvl)) == actual){
+                    internal_free_node(h, claimed[k], lvl+1);
+                    STATS_ADD(rollbacks, 1);
+                }
+                else
+                    claimed[kept++] = claimed[k];
+            }
+            if((c = kept) == 0){
+                *failed_at_node = actual;
+                return 0;
+            }
+        }
+        nn = j;
+    }
+    return c;
 }
 
 
@@ -307,20 +978,21 @@ void* bd_xx_malloc(size_t byte){
  This routine returns 0 if it succeeds to mark every bit from the allocated node to the root, 
  otherwise it returns the index of the node that made the allocation fail.
  */
-static unsigned long long alloc(unsigned long long n, unsigned long long lvl){
+static unsigned long long alloc(nbbs *h, unsigned long long n, unsigned long long lvl){
     unsigned long long actual_value;
     unsigned long long failed_at_node;
     unsigned long long new_value;
+    unsigned int retries;
     bool is_left_child;
     unsigned long long actual = n;
     
     // get tha state of the target node
-    actual_value = tree[n].val;
+    actual_value = NB_LOAD(&NODE_VAL(h, n));
     
     // try to allocate the node
-    if(actual_value != 0 || !__sync_bool_compare_and_swap(&(tree[n].val),0,OCCUPY_BLOCK)) return n;
+    if(actual_value != 0 || !NB_CAS_ACQUIRE(&NODE_VAL(h, n),0,OCCUPY_BLOCK)) return n;
         
-    while(lvl != max_level){
+    while(lvl != h->max_level){
     
         // parent node
         lvl--;
@@ -328,14 +1000,17 @@ static unsigned long long alloc(unsigned long long n, unsigned long long lvl){
         actual = parent_idx_by_idx(actual);
 
         // retry loop for fragmenting it
+        retries = 0;
         do{
-            actual_value = tree[actual].val;
+            BACKOFF_RETRY(retries);
+            actual_value = NB_LOAD_ACQUIRE(&NODE_VAL(h, actual));
             
             // check if parent has been fully occupied
             if((actual_value & OCCUPY)!=0){
                 failed_at_node = actual;
                 // we need to rollback the work done before failing
-                internal_free_node(n, lvl+1);
+                internal_free_node(h, n, lvl+1);
+                STATS_ADD(rollbacks, 1);
                 return failed_at_node;
             }
             
@@ -347,10 +1022,11 @@ static unsigned long long alloc(unsigned long long n, unsigned long long lvl){
             
             // if we are using the lock simply write otherwise go for a CAS
             #ifdef BD_SPIN_LOCK  
-                tree[actual].val = actual_value = new_value;
+                NB_STORE(&NODE_VAL(h, actual), new_value);
+                actual_value = new_value;
             #endif
         }while(new_value != actual_value && 
-                !__sync_bool_compare_and_swap(&(tree[actual].val), actual_value, new_value));
+                !NB_CAS_ACQUIRE(&NODE_VAL(h, actual), actual_value, new_value));
     }
     return 0;
 }
@@ -363,9 +1039,10 @@ static unsigned long long alloc(unsigned long long n, unsigned long long lvl){
  It might leave some coalescing bit set, but it is not a real issue (also allocations can clean them).
  */
 
-static inline void unmark(unsigned long long n, unsigned long long upper_bound){
+static inline void unmark(nbbs *h, unsigned long long n, unsigned long long upper_bound){
     unsigned long long actual_value;
     unsigned long long new_val;
+    unsigned int retries;
     bool is_left_child;
     unsigned long long actual = n;
     unsigned long long lvl = level_by_idx(actual);
@@ -377,8 +1054,10 @@ static inline void unmark(unsigned long long n, unsigned long long upper_bound){
         is_left_child = is_left_by_idx(actual);
         actual = parent_idx_by_idx(actual);
 
+        retries = 0;
         do{
-            actual_value = tree[actual].val;
+            BACKOFF_RETRY(retries);
+            actual_value = NB_LOAD_ACQUIRE(&NODE_VAL(h, actual));
             new_val = actual_value;
             
             // if bits have been already cleaned by a concurrent allocation we can return
@@ -390,10 +1069,11 @@ static inline void unmark(unsigned long long n, unsigned long long upper_bound){
             
             #ifdef BD_SPIN_LOCK  
                 // we have a lock so a simple write is enough 
-                tree[actual].val = actual_value = new_val;
+                NB_STORE(&NODE_VAL(h, actual), new_val);
+                actual_value = new_val;
             #endif
           // go for a cas 
-        } while (new_val != actual_value && !__sync_bool_compare_and_swap(&(tree[actual].val),actual_value,new_val));
+        } while (new_val != actual_value && !NB_CAS_ACQ_REL(&NODE_VAL(h, actual),actual_value,new_val));
     }while( (lvl != upper_bound) &&
             !( (new_val & (MASK_OCCUPY_LEFT >> is_left_child) ) != 0 )  
 
@@ -408,14 +1088,14 @@ static inline void unmark(unsigned long long n, unsigned long long upper_bound){
    2. Mark the target node as free
    3. Clean coalescent bits of the anchestors
  */
-static inline void internal_free_node(unsigned long long n, unsigned long long upper_bound){
+static inline void internal_free_node(nbbs *h, unsigned long long n, unsigned long long upper_bound){
     unsigned long long actual;
     unsigned long long runner, lvl;
     unsigned long long old_val;
     bool is_left_child;
 
-    assert(tree[n].val == OCCUPY_BLOCK);
-    if( tree[n].val != OCCUPY_BLOCK ){
+    assert(NB_LOAD(&NODE_VAL(h, n)) == OCCUPY_BLOCK);
+    if( NB_LOAD(&NODE_VAL(h, n)) != OCCUPY_BLOCK ){
         printf("err: il blocco non è occupato\n");
         return;
     }
@@ -425,7 +1105,7 @@ static inline void internal_free_node(unsigned long long n, unsigned long long u
     lvl = level_by_idx(runner);
         
     while(lvl != upper_bound){
-        old_val = __sync_fetch_and_or(&(tree[actual].val),  (MASK_RIGHT_COALESCE << (lchild_idx_by_idx(actual)==runner) ) ) ;
+        old_val = NB_FETCH_OR_ACQ_REL(&NODE_VAL(h, actual),  (MASK_RIGHT_COALESCE << (lchild_idx_by_idx(actual)==runner) ) ) ;
         is_left_child = is_left_by_idx(runner);
         
         if( ((old_val & (MASK_OCCUPY_LEFT >> is_left_child)) != 0 ) &&
@@ -438,31 +1118,357 @@ static inline void internal_free_node(unsigned long long n, unsigned long long u
         lvl--;
     }
     
-    tree[n].val = 0; // TODO aggiungi barriera --- secondo me "__sync_lock_release" va bene
-    if(n!=upper_bound)  unmark(n, upper_bound);
+    NB_STORE_RELEASE(&NODE_VAL(h, n), 0);
+    if(n!=upper_bound)  unmark(h, n, upper_bound);
+    oom_released(h);
 }
 
 /*
- API for memory release.
+ This function climbs the tree from a group of nodes, sorted in descending order, up to upper_bound.
+ Nodes sharing the parent are handled together, thus each ancestor is updated with a single atomic operation.
+ When mark is true it runs phase 1 of the release, otherwise phase 3 (see internal_free_node).
  */
-void bd_xx_free(void* n){
-    // Obtain the leaf corresponding to the address
-    unsigned long long tmp = ((unsigned long long)n) - (unsigned long long)overall_memory;
-    unsigned long long pos = (unsigned long long) tmp;
+static void climb_group(nbbs *h, unsigned long long *nodes, unsigned long long count, unsigned long long upper_bound, bool mark){
+    unsigned long long up[1ULL << MAX_BULK_SPAN], cur[1ULL << MAX_BULK_SPAN];
+    unsigned long long n_up = 0, n_cur, i, j = 0, lvl, actual, mask, cleaned, old_val, new_val;
+    unsigned int retries;
+    bool climb;
+    
+    if(count == 0) return;
+    lvl = level_by_idx(nodes[0]);
+    
+    while(lvl > upper_bound){
+        // merge the nodes coming from the level below with the released ones at this level
+        i = n_cur = 0;
+        while(i < n_up || (j < count && level_by_idx(nodes[j]) == lvl)){
+            if(j < count && level_by_idx(nodes[j]) == lvl && (i == n_up || nodes[j] > up[i]))
+                cur[n_cur++] = nodes[j++];
+            else
+                cur[n_cur++] = up[i++];
+        }
+        
+        n_up = 0;
+        for(i = 0; i < n_cur; ){
+            // collect the children of the same parent
+            actual = parent_idx_by_idx(cur[i]);
+            mask = 0;
+            do{
+                mask |= MASK_RIGHT_COALESCE << is_left_by_idx(cur[i]);
+                i++;
+            }while(i < n_cur && parent_idx_by_idx(cur[i]) == actual);
+            
+            if(mark){
+                old_val = NB_FETCH_OR_ACQ_REL(&NODE_VAL(h, actual), mask);
+                // a lone child stops if its brother is occupied and not coalescing
+                climb = true;
+                if(mask == MASK_LEFT_COALESCE)  climb = !( (old_val & MASK_OCCUPY_RIGHT) && !(old_val & MASK_RIGHT_COALESCE) );
+                if(mask == MASK_RIGHT_COALESCE) climb = !( (old_val & MASK_OCCUPY_LEFT)  && !(old_val & MASK_LEFT_COALESCE)  );
+            }
+            else{
+                retries = 0;
+                do{
+                    BACKOFF_RETRY(retries);
+                    old_val = NB_LOAD_ACQUIRE(&NODE_VAL(h, actual));
+                    // clean only the children whose bits have not been cleaned by a concurrent allocation
+                    cleaned = old_val & mask;
+                    new_val = old_val & ~(cleaned | (cleaned >> 2));
+                    #ifdef BD_SPIN_LOCK
+                        NB_STORE(&NODE_VAL(h, actual), new_val);
+                        old_val = new_val;
+                    #endif
+                }while(new_val != old_val && !NB_CAS_ACQ_REL(&NODE_VAL(h, actual), old_val, new_val));
+                climb = cleaned != 0 && (new_val & (MASK_OCCUPY_LEFT | MASK_OCCUPY_RIGHT)) == 0;
+            }
+            
+            if(climb && lvl-1 > upper_bound) up[n_up++] = actual;
+        }
+        
+        lvl--;
+        // skip the levels without nodes
+        if(n_up == 0){
+            if(j == count) break;
+            lvl = level_by_idx(nodes[j]);
+        }
+    }
+}
+
+/*
+ This routine releases a group of nodes, sorted in descending order, in the same three phases of
+ internal_free_node, but each ancestor shared by several nodes is visited only once per phase.
+ */
+static void internal_free_group(nbbs *h, unsigned long long *nodes, unsigned long long count, unsigned long long upper_bound){
+    unsigned long long i, n = 0;
+    
+    for(i = 0; i < count; i++){
+        assert(NB_LOAD(&NODE_VAL(h, nodes[i])) == OCCUPY_BLOCK);
+        if( NB_LOAD(&NODE_VAL(h, nodes[i])) != OCCUPY_BLOCK ){
+            printf("err: il blocco non è occupato\n");
+            continue;
+        }
+        nodes[n++] = nodes[i];
+    }
+    
+    climb_group(h, nodes, n, upper_bound, true);
+    for(i = 0; i < n; i++)  NB_STORE_RELEASE(&NODE_VAL(h, nodes[i]), 0);
+    climb_group(h, nodes, n, upper_bound, false);
+    oom_released(h);
+}
 
-    // Use the leaf position to obtain the allocated node 
-    pos = pos / MIN_ALLOCABLE_BYTES;
-    pos = free_tree[pos].val;
+/*
+ API for memory release on a given instance.
+ */
+void nbbs_free(nbbs *h, void* n){
+    unsigned long long pos;
+
+    if(n == NULL) return;
+
+    // Use the leaf corresponding to the address to obtain the level, and then the allocated node
+    pos = node_idx_by_address(h, n);
+
+    decommit_release(h, n, h->overall_memory_size >> (level_by_idx(pos) - 1));
+    stats_free(h->overall_memory_size >> (level_by_idx(pos) - 1));
 
     // update local cache 
     update_freemap(level_by_idx(pos), pos);
 
     // start actual release of the memory block 
-    BD_LOCK(&glock);
-    internal_free_node(pos, max_level);
-    BD_UNLOCK(&glock);
-#ifdef DEBUG
-    __sync_fetch_and_add(node_allocated,-1);
-    __sync_fetch_and_add(size_allocated,-(n->mem_size));
-#endif
+    BD_LOCK(&h->glock);
+    internal_free_node(h, pos, h->max_level);
+    BD_UNLOCK(&h->glock);
+}
+
+/*
+ API for memory release on a given instance when the size of the block is known.
+ The allocated node is computed from the address and the size, without reading the translation table.
+ */
+void nbbs_free_sized(nbbs *h, void* n, size_t byte){
+    unsigned long long pos;
+
+    if(n == NULL) return;
+
+    pos = node_idx_by_address_and_size(h, n, block_size(h, byte));
+
+    decommit_release(h, n, block_size(h, byte));
+    stats_free(block_size(h, byte));
+
+    // update local cache 
+    update_freemap(level_by_idx(pos), pos);
+
+    // start actual release of the memory block 
+    BD_LOCK(&h->glock);
+    internal_free_node(h, pos, h->max_level);
+    BD_UNLOCK(&h->glock);
+}
+
+/*
+ API for bulk memory release on a given instance.
+ */
+void nbbs_free_bulk(nbbs *h, void **ptrs, unsigned int count){
+    free_bulk(h, ptrs, count, 0);
+}
+
+/*
+ API for bulk memory release on a given instance when all the blocks have the same known size.
+ */
+void nbbs_free_bulk_sized(nbbs *h, void **ptrs, unsigned int count, size_t byte){
+    free_bulk(h, ptrs, count, block_size(h, byte));
+}
+
+/*
+ This function releases a group of blocks. If byte is not zero it is the size of all the blocks,
+ otherwise the allocated nodes are read from the translation table.
+ Blocks are sorted by node, so that the ones sharing ancestors are released together
+ with a single visit of each common ancestor.
+ */
+static void free_bulk(nbbs *h, void **ptrs, unsigned int count, unsigned long long byte){
+    unsigned long long nodes[1ULL << MAX_BULK_SPAN];
+    unsigned long long i, n;
+
+    while(count > 0){
+        n = count < (1ULL << MAX_BULK_SPAN) ? count : (1ULL << MAX_BULK_SPAN);
+        
+        // Use the address to obtain the allocated node
+        for(i = 0; i < n; i++){
+            nodes[i] = byte ? node_idx_by_address_and_size(h, ptrs[i], byte) : node_idx_by_address(h, ptrs[i]);
+            decommit_release(h, ptrs[i], h->overall_memory_size >> (level_by_idx(nodes[i]) - 1));
+            stats_free(h->overall_memory_size >> (level_by_idx(nodes[i]) - 1));
+            update_freemap(level_by_idx(nodes[i]), nodes[i]);
+        }
+        sort_desc_ull(nodes, n);
+        
+        BD_LOCK(&h->glock);
+        internal_free_group(h, nodes, n, h->max_level);
+        BD_UNLOCK(&h->glock);
+        
+        ptrs  += n;
+        count -= n;
+    }
+}
+
+/*
+ This function takes the left child of the node n, owned by the caller, so that n can then be halved by halve_node.
+ No allocation can succeed below an allocated node, thus the left child can only be busy because of an allocation
+ that is going to fail at n and roll back: in that case false is returned, and the caller can retry.
+ */
+static bool hold_lchild(nbbs *h, unsigned long long n){
+    unsigned long long lchild = lchild_idx_by_idx(n);
+
+    return NB_LOAD(&NODE_VAL(h, lchild)) == 0 && NB_CAS_ACQUIRE(&NODE_VAL(h, lchild), 0, OCCUPY_BLOCK);
+}
+
+/*
+ This function gives back the left child of the node n taken by hold_lchild, when n is not going to be halved.
+ */
+static void unhold_lchild(nbbs *h, unsigned long long n){
+    NB_STORE_RELEASE(&NODE_VAL(h, lchild_idx_by_idx(n)), 0);
+}
+
+/*
+ This function moves the allocation of the node n, owned by the caller, to its left child, taken by hold_lchild,
+ and releases the right child.
+ */
+static void halve_node(nbbs *h, unsigned long long n){
+    // nobody else writes an allocated node: n becomes an ancestor of the left child, as alloc would leave it
+    NB_STORE_RELEASE(&NODE_VAL(h, n), MASK_OCCUPY_LEFT);
+}
+
+/*
+ This function takes the right buddy of the node n, owned by the caller and left child of its parent,
+ as alloc would claim a target node, so that n can then be doubled by grow_node. It returns false if the buddy is not free.
+ */
+static bool claim_buddy(nbbs *h, unsigned long long n){
+    return NB_LOAD(&NODE_VAL(h, n + 1)) == 0 && NB_CAS_ACQUIRE(&NODE_VAL(h, n + 1), 0, OCCUPY_BLOCK);
+}
+
+/*
+ This function gives back the right buddy of the node n taken by claim_buddy, when n is not going to be doubled.
+ */
+static void unclaim_buddy(nbbs *h, unsigned long long n){
+    NB_STORE_RELEASE(&NODE_VAL(h, n + 1), 0);
+}
+
+/*
+ This function moves the allocation of the node n, owned by the caller and left child of its parent, to the parent.
+ The right buddy has to be taken by claim_buddy first.
+ */
+static void grow_node(nbbs *h, unsigned long long n){
+    unsigned long long sibling = n + 1, parent = parent_idx_by_idx(n), actual_value;
+    unsigned int retries;
+
+    // the parent cannot be allocated while n is, so only the bits left by a release in the sibling can change
+    retries = 0;
+    do{
+        BACKOFF_RETRY(retries);
+        actual_value = NB_LOAD_ACQUIRE(&NODE_VAL(h, parent));
+    }while(!NB_CAS_ACQ_REL(&NODE_VAL(h, parent), actual_value, OCCUPY_BLOCK));
+
+    // the children are inside the block now, and have to be free when it is released
+    NB_STORE_RELEASE(&NODE_VAL(h, n), 0);
+    NB_STORE_RELEASE(&NODE_VAL(h, sibling), 0);
+}
+
+/*
+ This function resizes in place the block at address ptr to the blocks serving byte bytes.
+ A block shrinks by handing back its right halves, so that a sized release can be given the new size;
+ it grows by taking its right buddies, which requires the block to be the left half of each larger one.
+ The nodes of all the levels crossed are taken before the block is changed: if one of them cannot be taken,
+ those already taken are given back and the block is left as it was.
+ It returns true if the block now serves byte bytes.
+ */
+static bool resize_in_place(nbbs *h, void *ptr, unsigned long long byte){
+    unsigned long long n = node_idx_by_address(h, ptr), lvl = level_by_idx(n), half, m, k;
+    unsigned long long target = level_by_idx(h->overall_memory_size / block_size(h, byte));
+    unsigned long long old_size = h->overall_memory_size >> (lvl - 1);
+    unsigned int retries;
+    bool held = true, released = false;
+
+    BD_LOCK(&h->glock);
+    if(lvl < target){
+        // a busy left half is an allocation rolling back, which does not last: it is waited for a bounded time
+        for(m = n, k = lvl; k < target && held; k++){
+            retries = 0;
+            do{
+                BACKOFF_RETRY(retries);
+            }while(!(held = hold_lchild(h, m)) && retries < RESIZE_RETRIES);
+            if(held) m = lchild_idx_by_idx(m);
+        }
+        while(!held && m != n){
+            m = parent_idx_by_idx(m);
+            unhold_lchild(h, m);
+        }
+        for(; held && lvl < target; lvl++){
+            // the right half is given back, its pages can go as for a release
+            half = h->overall_memory_size >> lvl;
+            decommit_release(h, (char*) ptr + half, half);
+            halve_node(h, n);
+            update_freemap(lvl + 1, rchild_idx_by_idx(n));
+            n = lchild_idx_by_idx(n);
+            released = true;
+        }
+    }
+    else if(lvl > target){
+        for(m = n, k = lvl; k > target && is_left_by_idx(m) && claim_buddy(h, m); k--) m = parent_idx_by_idx(m);
+        while(k > target && m != n){
+            m = lchild_idx_by_idx(m);
+            unclaim_buddy(h, m);
+        }
+        for(; k == target && lvl > target; lvl--){
+            grow_node(h, n);
+            n = parent_idx_by_idx(n);
+        }
+    }
+    BD_UNLOCK(&h->glock);
+
+    if(released) oom_released(h);
+    if((h->overall_memory_size >> (lvl - 1)) != old_size) stats_resize(old_size, h->overall_memory_size >> (lvl - 1));
+  #ifndef BD_NO_FREE_TREE
+    h->free_tree[offset_by_address(h, ptr) / h->min_size] = lvl;
+  #endif
+    return lvl == target;
+}
+
+/*
+ This function takes a node of the tree on behalf of the scavenger. It returns false if the node is not free.
+ */
+static bool claim_node(nbbs *h, unsigned long long n){
+    unsigned long long failed_at_node;
+
+    BD_LOCK(&h->glock);
+    failed_at_node = alloc(h, n, level_by_idx(n));
+    BD_UNLOCK(&h->glock);
+    return failed_at_node == 0;
+}
+
+/*
+ This function gives back a node taken by claim_node.
+ */
+static void release_node(nbbs *h, unsigned long long n){
+    BD_LOCK(&h->glock);
+    internal_free_node(h, n, h->max_level);
+    BD_UNLOCK(&h->glock);
+}
+
+
+/*
+ This function classifies a node for the guided search from its occupancy bits.
+ */
+static inline unsigned int node_state(nbbs *h, unsigned long long n, unsigned long long lvl){
+    unsigned long long val = NB_LOAD(&NODE_VAL(h, n));
+
+    if((val & OCCUPY) != 0)                                 return NODE_FULL;
+    if((val & (MASK_OCCUPY_LEFT | MASK_OCCUPY_RIGHT)) != 0) return NODE_PARTIAL;
+    return NODE_FREE;
+}
+
+/*
+ This function allocates the node n at level lvl for the guided search.
+ */
+static inline unsigned long long try_alloc(nbbs *h, unsigned long long n, unsigned long long lvl){
+    unsigned long long failed_at_node;
+
+    STATS_ADD(attempts, 1);
+    BD_LOCK(&h->glock);
+    failed_at_node = alloc(h, n, lvl);
+    BD_UNLOCK(&h->glock);
+    return failed_at_node;
 }
@@ -45,16 +45,95 @@
 #define NUM_LEVELS          12ULL               // Default value 
 #endif
 
+#ifndef PADDED_LEVELS                           // Number of top levels with a cache line per node
+#define PADDED_LEVELS       48ULL               // Default value: all of them
+#endif
+
 //#define DEBUG
 
+//#define BD_NO_FREE_TREE                       // Drop the translation table: only sized releases are allowed
+
+//#define BD_QUIET                              // Do not print the shape of the default instance at startup
+
+/*
+ The parameters above only describe the default instance, which is built at
+ startup and backs bd_xx_malloc/bd_xx_free. They can be overridden at runtime
+ through the environment variables NBBS_MIN, NBBS_MAX and NBBS_NUM_LEVELS.
+ NBBS_PADDED_LEVELS overrides PADDED_LEVELS for every instance: nodes below those
+ levels are packed 8 per cache line.
+ On NUMA machines the default instance is replicated on every node, see ../numa.h;
+ NBBS_NUMA_NODES sets the number of replicas.
+ NBBS_HUGEPAGES selects the huge page backing of every instance, see ../hugepage.h.
+ NBBS_DECOMMIT and NBBS_SCAVENGE set the policy giving free memory back to the OS, see ../decommit.h.
+ Further instances of any shape can be created with nbbs_create.
+ */
+
+typedef struct _nbbs nbbs;                  // Handle of an NBBS instance
+
 void  bd_xx_free(void* n);                  // Release API
 void* bd_xx_malloc(size_t bytes);           // Alloc   API
+void* bd_xx_aligned_alloc(size_t align, size_t bytes); // Aligned alloc API
 void  init();                               // Init    API
+unsigned int bd_xx_malloc_bulk(size_t bytes, unsigned int count, void **out); // Bulk alloc API
+void  bd_xx_free_bulk(void **ptrs, unsigned int count);                        // Bulk release API
+void  bd_xx_free_sized(void* n, size_t bytes);                                 // Sized release API
+void  bd_xx_free_bulk_sized(void **ptrs, unsigned int count, size_t bytes);    // Sized bulk release API
+void* bd_xx_realloc(void* n, size_t bytes);                                    // Realloc API
+void  bd_xx_footprint(size_t *committed, size_t *reserved);                     // Footprint API
+size_t bd_xx_usable_size(void* n);                                             // Usable size API
 
-#ifdef DEBUG
-extern unsigned long long *node_allocated;  // Additional variable for debugging
-extern nbint *size_allocated;               // Additional variable for debugging
-#endif
+nbbs* nbbs_create(size_t size, size_t min, size_t max); // Create  API
+void  nbbs_destroy(nbbs *h);                            // Destroy API
+void* nbbs_malloc(nbbs *h, size_t bytes);               // Alloc   API
+void* nbbs_aligned_alloc(nbbs *h, size_t align, size_t bytes); // Aligned alloc API
+void  nbbs_free(nbbs *h, void* n);                      // Release API
+unsigned int nbbs_malloc_bulk(nbbs *h, size_t bytes, unsigned int count, void **out); // Bulk alloc API
+void  nbbs_free_bulk(nbbs *h, void **ptrs, unsigned int count);                        // Bulk release API
+void  nbbs_free_sized(nbbs *h, void* n, size_t bytes);                                 // Sized release API
+void  nbbs_free_bulk_sized(nbbs *h, void **ptrs, unsigned int count, size_t bytes);    // Sized bulk release API
+void* nbbs_realloc(nbbs *h, void* n, size_t bytes);                                    // Realloc API
+void  nbbs_footprint(nbbs *h, size_t *committed, size_t *reserved);                  // Footprint API
+size_t nbbs_usable_size(nbbs *h, void* n);                                     // Usable size API
+nbbs* nbbs_default();                                   // Default instance
+
+/*
+ Counters of the operations on all the trees, kept by each thread and summed on demand, see ../stats.h.
+ The order of a block is the log2 of its size.
+ */
+#define NBBS_STATS_ORDERS   64
+
+struct nbbs_stats{
+    unsigned long long allocs[NBBS_STATS_ORDERS];   // blocks taken, by order
+    unsigned long long frees[NBBS_STATS_ORDERS];    // blocks released, by order
+    unsigned long long failures[NBBS_STATS_ORDERS]; // requests that found no free block, by order
+    unsigned long long attempts;                    // nodes tried by the allocations, over the blocks taken: attempts per success
+    unsigned long long cas_retries;                 // CAS on the tree retried after a failure
+    unsigned long long rollbacks;                   // claimed nodes given back because an ancestor was taken
+    long long bytes_in_use;                         // bytes of the blocks taken and not released
+    unsigned int threads;                           // blocks of counters, i.e. the most threads alive at once
+};
+
+void  nbbs_stats(struct nbbs_stats *stats);             // Statistics API
+
+/*
+ Free space of a tree, read by a walk down to level depth (0 for the whole tree) that does not block
+ the allocations, see ../frag.h.
+ nbbs_frag also sets largest[i], for i below count, to the order of the largest free block
+ below the i-th node at the level of the largest blocks, NBBS_FRAG_FULL if there is none,
+ and returns the number of those nodes.
+ */
+#define NBBS_FRAG_FULL      0xFF
+
+struct nbbs_frag{
+    unsigned long long free_blocks[NBBS_STATS_ORDERS]; // free blocks not part of a larger free one, by order
+    unsigned long long free_bytes;                     // bytes of those blocks
+    unsigned long long largest;                        // bytes of the largest one
+    unsigned long long unwalked;                       // partly occupied nodes at the deepest level walked, whose free blocks are not counted
+    double fragmentation;                              // external fragmentation index, the share of free_bytes not in blocks of the largest size
+};
+
+unsigned long long nbbs_frag(nbbs *h, struct nbbs_frag *frag, unsigned long long depth, unsigned char *largest, unsigned long long count); // Fragmentation API
+void  bd_xx_frag(struct nbbs_frag *frag, unsigned long long depth);                                                                        // Fragmentation API
 
 #ifndef BD_SPIN_LOCK                        // Define empty macro for lock API
     #define BD_LOCK_TYPE     /**/
@@ -1,2 +1,3 @@
+#define _GNU_SOURCE
 #include "sl1lvl.h"
 #include "../1lvl-nb/nballoc.c"
\ No newline at end of file
@@ -25,10 +25,14 @@
 * 
 */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <string.h>
 #include <errno.h>
 #include <sys/mman.h>
 #include <time.h>
@@ -72,10 +76,10 @@ Bitmap for container:
 #define LEAF_START_POSITION (8) //la prima foglia del grappolo.. dipende dalla grandezza dei grappoli e si riferisce al node_container
 
 #define IS_FREE(val, pos)  !IS_OCCUPIED(val, pos)
-#define IS_LEAF(n) (((n)->container_pos) >= (LEAF_START_POSITION)) //attenzione: questo ti dice se il figlio è tra le posizione 8-15. Se sei foglia di un grappolo piccolo qua non lo vedi
+#define IS_LEAF(n) ((container_pos_by_idx(n)) >= (LEAF_START_POSITION)) //attenzione: questo ti dice se il figlio è tra le posizione 8-15. Se sei foglia di un grappolo piccolo qua non lo vedi
 
-#define IS_BUNCHROOT(n) ( (n->container_pos) == (1) )
-#define BUNCHROOT(n) ((n->container->bunch_root))
+#define IS_BUNCHROOT(n) ( (container_pos_by_idx(n)) == (1) )
+#define BUNCHROOT(n) (bunchroot_idx_by_idx_and_lvl((n), level_by_idx(n)))
 
 #define LOCK_NOT_A_LEAF(val, pos)			((val)   | ( ((LOCK_NOT_LEAF_MASK) << ((pos-1)))))
 #define UNLOCK_NOT_A_LEAF(val, pos)			((val)   & (~((LOCK_NOT_LEAF_MASK) << ((pos-1)))))
@@ -111,77 +115,122 @@ Bitmap for container:
 			){ do_exit=true; break;}\
 		}
 
-#define VAL_OF_NODE(n) ((unsigned long long) (n->container_pos<LEAF_START_POSITION ) ? ((n->container->nodes & (0x1ULL << (n->container_pos-1))) >> (n->container_pos-1)) : ((n->container->nodes & (LEAF_FULL_MASK << ((LEAF_START_POSITION-1) + (5 * ((n->container_pos-1) - (LEAF_START_POSITION-1))))))) >> ((LEAF_START_POSITION-1) + (5 * ((n->container_pos-1) - (LEAF_START_POSITION-1)))))
-
-#define ROOT 			(tree[1])
+#define VAL_OF_NODE(n) ((unsigned long long) (container_pos_by_idx(n)<LEAF_START_POSITION ) ? ((container_by_idx(n)->nodes >> (container_pos_by_idx(n)-1)) & 0x1ULL) : (BITMASK_LEAF(container_by_idx(n)->nodes, container_pos_by_idx(n))))
 
-#define level(n) ((unsigned int) ( (overall_height) - (log2_(( (n)->mem_size) / (MIN_ALLOCABLE_BYTES )) )))
 #define level_by_idx(n) ( 1 + (log2_(n)))
 
-#define lchild_idx_by_ptr(n)   (((n)->pos)*2)
-#define rchild_idx_by_ptr(n)   (lchild_idx_by_ptr(n)+1)
-#define parent_idx_by_ptr(n)   (((n)->pos)/2)
-
 #define lchild_idx_by_idx(n)   (n << 1)
 #define rchild_idx_by_idx(n)   (lchild_idx_by_idx(n)+1)
 #define parent_idx_by_idx(n)   (n >> 1)
 
-#define lchild_ptr_by_ptr(n)   (tree[lchild_idx_by_ptr(n)])
-#define rchild_ptr_by_ptr(n)   (tree[rchild_idx_by_ptr(n)])
-#define parent_ptr_by_ptr(n)   (tree[parent_idx_by_ptr(n)])
-
-#define lchild_ptr_by_idx(n)   (tree[lchild_idx_by_idx(n)])
-#define rchild_ptr_by_idx(n)   (tree[rchild_idx_by_idx(n)])
-#define parent_ptr_by_idx(n)   (tree[parent_idx_by_idx(n)])
-
 #define is_leaf_by_idx(n) ((n) >= (LEAF_START_POSITION)) //attenzione: questo ti dice se il figlio è tra le posizione 8-15. Se sei foglia di un grappolo piccolo qua non lo vedi
 #define is_left_by_idx(n)	(1ULL & (~(n)))
 #define is_right_by_idx(n)	(1ULL & ( (n)))
+#define node_idx_by_address_and_size(h, ptr, size) (((h)->overall_memory_size + ((unsigned long long)(ptr)) - (unsigned long long)(h)->overall_memory) >> log2_(size)) //size deve essere quella del blocco allocato
+#ifndef BD_NO_FREE_TREE
+#define node_idx_by_address(h, ptr) node_idx_by_address_and_size(h, ptr, (h)->overall_memory_size >> ((h)->free_tree[(((unsigned long long)(ptr)) - (unsigned long long)(h)->overall_memory) / (h)->min_size] - 1))
+#else
+#define node_idx_by_address(h, ptr) unsized_release()
+#endif
 
 #define bunchroot_idx_by_idx_and_lvl(n, lvl) ( (n) >> ( (lvl-1) & 3ULL) )
 #define bunchroot_lvl_by_lvl(lvl) ( (lvl) - ( (lvl-1) & 3ULL) )
 
+//i nodi non hanno descrittori: container e posizione nel container dipendono solo dall'indice.
+//I container sono numerati in ampiezza, prima di quelli dei grappoli radicati al livello b ce ne sono (2^(b-1)-1)/15
+#define container_pos_by_idx_and_lvl(n, lvl) ( (1ULL << ( (lvl-1) & 3ULL)) | ((n) & ((1ULL << ( (lvl-1) & 3ULL)) - 1)) )
+#define container_idx_by_idx_and_lvl(n, lvl) ( ((1ULL << (bunchroot_lvl_by_lvl(lvl)-1)) - 1)/15 + bunchroot_idx_by_idx_and_lvl(n, lvl) - (1ULL << (bunchroot_lvl_by_lvl(lvl)-1)) )
+#define container_pos_by_idx(n) container_pos_by_idx_and_lvl(n, level_by_idx(n))
+#define container_by_idx(n) (&h->containers[container_idx_by_idx_and_lvl(n, level_by_idx(n))])
+
 //PARAMETRIZZAZIONE
 #define LEVEL_PER_CONTAINER 4
+#define MAX_BULK_SPAN 8ULL //al massimo 2^MAX_BULK_SPAN nodi vengono presi insieme da una allocazione multipla
+#define RESIZE_RETRIES 64U //tentativi di prendere una metà sinistra occupata quando un blocco si riduce sul posto
 
-/* VARIABILI GLOBALI *//*---------------------------------------------------------------------------------------------*/
+/* ISTANZA *//*---------------------------------------------------------------------------------------------*/
 
-static node *tree; //array che rappresenta l'albero, tree[0] è dummy! l'albero inizia a tree[1].
-static node *free_tree = NULL;
-static node_container* containers; //array di container In Numa questo sarà uno specifico tree (di base tree[getMyNUMANode])
-unsigned long long overall_memory_size;
-unsigned long long overall_memory_pages;
-unsigned long long overall_height;
-static unsigned long long max_level; //Ultimo livello utile per un allocazione
-unsigned long long number_of_leaves;
-unsigned long long number_of_nodes; //questo non tiene presente che tree[0] è dummy! se qua c'è scritto 7 vuol dire che ci sono 7 nodi UTILIZZABILI
-//unsigned int number_of_processes;
-unsigned long long number_of_container;
-static volatile unsigned long long levels = NUM_LEVELS;
-void* overall_memory;
-
-#ifdef DEBUG
-unsigned long long *node_allocated, *size_allocated;
+struct _nbbs{
+#ifndef BD_NO_FREE_TREE
+	unsigned char *free_tree; //tabella da foglia a livello del nodo allocato
 #endif
-
+	node_container* containers; //array di container, l'unico stato dell'albero. Il nodo 1 è la radice, i figli di n sono 2n e 2n+1
+	void* overall_memory;
+	unsigned long long overall_memory_size;
+	unsigned long long overall_height;
+	unsigned long long max_level; //Ultimo livello utile per un allocazione
+	unsigned long long number_of_leaves;
+	unsigned long long number_of_nodes; //nodi utilizzabili, con indici da 1 a number_of_nodes
+	unsigned long long number_of_container;
+	unsigned long long min_size; //minima taglia allocabile
+	unsigned long long max_size; //massima taglia allocabile
+	unsigned long long chunk_size; //granularità dello scavenger
+	unsigned char *idle; //idle[c] dice da quante passate il chunk c è sporco e libero, NULL se il decommit è disattivato
+	unsigned long long scavenging; //incrementato dallo scavenger attorno a ogni claim, dispari mentre tiene un chunk
 #ifdef BD_SPIN_LOCK
-BD_LOCK_TYPE glock;
+	BD_LOCK_TYPE glock;
 #endif
+	volatile unsigned long long oom __attribute__((aligned(64))); //livello più profondo senza nodi liberi (vedi oom.h), su una linea di cache tutta sua
+};
 
+/* VARIABILI GLOBALI *//*---------------------------------------------------------------------------------------------*/
 
 __thread unsigned int tid=-1;
 unsigned int partecipants=0;
 
 /* DICHIARAZIONE DI FUNZIONI *//*---------------------------------------------------------------------------------------------*/
 
-static void init_tree(unsigned long long number_of_nodes);
-static unsigned long long alloc(unsigned long long n_idx, unsigned long long n_lvl, unsigned long long br_lvl);
-static void marca(node* n, unsigned long long upper_bound);
+static bool nbbs_init(nbbs *h, unsigned long long levels, unsigned long long min, unsigned long long max, int numa_node);
+static void nbbs_fini(nbbs *h);
+static void init_tree(nbbs *h);
+static unsigned long long alloc(nbbs *h, unsigned long long n_idx, unsigned long long n_lvl, unsigned long long br_lvl);
+static void marca(nbbs *h, unsigned long long n, unsigned long long upper_bound);
 static bool IS_OCCUPIED(unsigned long long, unsigned);
-static unsigned long long check_parent(unsigned long long n_idx, unsigned long long n_lvl);
-static void smarca(node* n, unsigned long long upper_bound);
-static void internal_free_node(node* n, unsigned long long upper_bound);
-void* bd_xx_malloc(size_t pages);
+static unsigned long long check_parent(nbbs *h, unsigned long long n_idx, unsigned long long n_lvl);
+static unsigned long long alloc_group(nbbs *h, unsigned long long a, unsigned long long span, unsigned long long lvl, unsigned long long want, unsigned long long *claimed, unsigned long long *failed_at);
+static void smarca(nbbs *h, unsigned long long n, unsigned long long upper_bound);
+static void internal_free_node(nbbs *h, unsigned long long n, unsigned long long upper_bound);
+static void internal_free_group(nbbs *h, unsigned long long *nodes, unsigned long long count, unsigned long long upper_bound);
+static void free_bulk(nbbs *h, void **ptrs, unsigned int count, unsigned long long byte);
+static bool claim_node(nbbs *h, unsigned long long n);
+static void release_node(nbbs *h, unsigned long long n);
+static bool resize_in_place(nbbs *h, void *ptr, unsigned long long byte);
+static inline unsigned int node_state(nbbs *h, unsigned long long n, unsigned long long lvl);
+static inline unsigned long long try_alloc(nbbs *h, unsigned long long n, unsigned long long lvl);
+
+
+/*
+ Restituisce la taglia dei blocchi che servono una richiesta di byte byte.
+ */
+static inline unsigned long long block_size(nbbs *h, unsigned long long byte){
+	byte = upper_power_of_two(byte);
+	return byte < h->min_size ? h->min_size : byte;
+}
+
+#ifdef BD_NO_FREE_TREE
+/*
+ Senza la free_tree il nodo allocato si trova solo a partire dalla taglia del blocco.
+ */
+static unsigned long long unsized_release(){
+	NB_ABORT("Built without free_tree: blocks must be released through the sized API\n");
+	return 0;
+}
+#endif
+
+
+#include "../atomics.h"
+#include "../stats.h"
+#include "../magazine.h"
+#include "../hugepage.h"
+#include "../numa.h" //numa_slot[i] è l'istanza usata da bd_xx_malloc e bd_xx_free sul nodo i, poi le arene
+#include "../decommit.h"
+#include "../search.h"
+#include "../frag.h"
+#include "../oom.h"
+#include "scan.h"
+#include "../backoff.h"
+#include "../arena.h"
+#include "../slab.h"
 
 
 
@@ -189,93 +238,159 @@ void* bd_xx_malloc(size_t pages);
 
 //MARK: INIT
 /*
- Questa funzione inizializza l'albero. Non il nodo dummy (tree[0])
- @param number_of_nodes: the number of nodes.
- */
-static void init_tree(unsigned long long number_of_nodes){
-	unsigned long long i=0;
-
-	number_of_container = 0;
-	
-	ROOT.mem_start = 0ULL;
-	ROOT.mem_size = overall_memory_size;
-	ROOT.pos = 1ULL;
-	ROOT.container = &containers[number_of_container++];
-	ROOT.container_pos = 1ULL;
-	ROOT.container->bunch_root = &ROOT;
-    ROOT.container->nodes = 0ULL;
-    containers[number_of_container-1].bunch_root = NULL;
-	for(i=2;i<=number_of_nodes;i++){
-		tree[i].pos = i;
-		node parent = parent_ptr_by_ptr(&tree[i]);
-		tree[i].mem_size = (parent.mem_size) / 2;
-		tree[i].mem_start = (parent.mem_start);
-		if(i%2!=0)
-			tree[i].mem_start += tree[i].mem_size;
-		
-		if(level(&tree[i])%LEVEL_PER_CONTAINER==1){
-			tree[i].container = &containers[number_of_container++];
-			tree[i].container_pos = 1ULL;
-			tree[i].container->nodes = 0ULL;
-			tree[i].container->bunch_root = &tree[i];
-		}
-		else{
-			tree[i].container = parent.container;
-			tree[i].container_pos = (parent.container_pos*2)+(1&(lchild_idx_by_ptr(&parent)!=i));
-		}
-	}
+ Questa funzione inizializza l'istanza. La memoria appena mappata è già a zero, quindi tutti i container sono liberi.
+ @param h: l'istanza da inizializzare.
+ */
+static void init_tree(nbbs *h){
 	#ifdef BD_SPIN_LOCK
     #if BD_SPIN_LOCK == 0
     pthread_mutexattr_t attr;
     pthread_mutexattr_init(&attr);
     pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
-    pthread_mutex_init(&(glock), &attr);
+    pthread_mutex_init(&(h->glock), &attr);
     #else
-    pthread_spin_init(&(glock), PTHREAD_PROCESS_SHARED);
+    pthread_spin_init(&(h->glock), PTHREAD_PROCESS_SHARED);
     #endif
     #endif
 }
 
 
 /*
-	@param pages: pagine richieste. Questo sarà il valore della radice
+ Questa funzione costruisce un'istanza con la forma richiesta e ne mappa la memoria.
+ @param levels: numero di livelli dell'albero
+ @param min: taglia minima allocabile
+ @param max: taglia massima allocabile
+ @param numa_node: nodo NUMA a cui legare la memoria, -1 per nessuno
+ @return false se la forma non è valida o se la memoria non è disponibile
  */
-static void init(){
-	number_of_nodes = (1<<levels) - 1;
+static bool nbbs_init(nbbs *h, unsigned long long levels, unsigned long long min, unsigned long long max, int numa_node){
+	if(min == 0 || max < min || levels == 0 || levels > 48)
+		return false;
+	
+	h->min_size = min = upper_power_of_two(min);
+	h->max_size = max = upper_power_of_two(max);
+	h->number_of_nodes = (1ULL<<levels) - 1;
+	h->number_of_leaves = (1ULL<< (levels-1));
+	h->overall_memory_size = min * h->number_of_leaves;
+	h->overall_height = levels;
+	//un container per ogni radice di grappolo, ai livelli 1, 5, 9, ...
+	h->number_of_container = ((1ULL << (4*((levels+LEVEL_PER_CONTAINER-1)/LEVEL_PER_CONTAINER))) - 1)/15;
 	
-	number_of_leaves = (1<< (levels-1));
-	overall_memory_size = MIN_ALLOCABLE_BYTES * number_of_leaves;
-	overall_height = levels;
-	max_level = overall_height - log2_(MAX_ALLOCABLE_BYTES/MIN_ALLOCABLE_BYTES); //last valid allocable level
+	if(h->overall_memory_size < max)
+		return false;
+	
+	h->max_level = h->overall_height - log2_(max/min); //last valid allocable level
 	//max_level = ((unsigned long long)((max_level-1)/4))*4 + 1;//max_level - max_level%4 + 1;  
 
-
-	overall_memory 	= mmap(NULL, overall_memory_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
-	tree 			= mmap(NULL,(1+number_of_nodes)*sizeof(node), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
-	containers 		= mmap(NULL,(number_of_nodes-1)*sizeof(node_container), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
-	free_tree  		= mmap(NULL,64+(number_of_leaves)*sizeof(node), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	h->overall_memory 	= hugepage_map_aligned(h->overall_memory_size, h->max_size); //allineata al blocco più grande, così ogni blocco è allineato alla sua taglia anche in memoria virtuale
+	h->containers 		= hugepage_map(h->number_of_container*sizeof(node_container));
+#ifndef BD_NO_FREE_TREE
+	h->free_tree  		= hugepage_map(64+(h->number_of_leaves));
+#endif
      
-	if(overall_memory==MAP_FAILED || tree==MAP_FAILED || containers==MAP_FAILED || free_tree==MAP_FAILED){
+	if(h->overall_memory==MAP_FAILED || h->containers==MAP_FAILED 
+#ifndef BD_NO_FREE_TREE
+		|| h->free_tree==MAP_FAILED
+#endif
+	){
+		if(h->overall_memory!=MAP_FAILED) hugepage_unmap(h->overall_memory, h->overall_memory_size);
+		if(h->containers!=MAP_FAILED) hugepage_unmap(h->containers, h->number_of_container*sizeof(node_container));
+#ifndef BD_NO_FREE_TREE
+		if(h->free_tree!=MAP_FAILED) hugepage_unmap(h->free_tree, 64+(h->number_of_leaves));
+#endif
+		return false;
+	}
+	
+	//la memoria non è ancora stata toccata: tutte le pagine verranno dal nodo
+	if(!numa_bind(h->overall_memory, h->overall_memory_size, numa_node)
+		|| !numa_bind(h->containers, h->number_of_container*sizeof(node_container), numa_node)
+#ifndef BD_NO_FREE_TREE
+		|| !numa_bind(h->free_tree, 64+(h->number_of_leaves), numa_node)
+#endif
+	)
+		numa_bound = false;
+	
+	init_tree(h);
+	decommit_setup(h);
+	h->oom = 0;
+	return true;
+}
+
+
+/*
+ Questa funzione rilascia la memoria di un'istanza.
+ */
+static void nbbs_fini(nbbs *h){
+	hugepage_unmap(h->overall_memory, h->overall_memory_size);
+	hugepage_unmap(h->containers, h->number_of_container*sizeof(node_container));
+#ifndef BD_NO_FREE_TREE
+	hugepage_unmap(h->free_tree, 64+(h->number_of_leaves));
+#endif
+	decommit_fini(h);
+}
+
+
+/*
+	Costruisce le istanze di default, una per nodo NUMA. La forma può essere cambiata a runtime tramite NBBS_MIN, NBBS_MAX e NBBS_NUM_LEVELS.
+ */
+static void init(){
+	nbbs *h = &numa_heap[0];
+	unsigned long long min, max, levels;
+	
+	min 	= getenv_ull("NBBS_MIN", MIN_ALLOCABLE_BYTES);
+	max 	= getenv_ull("NBBS_MAX", MAX_ALLOCABLE_BYTES);
+	levels 	= getenv_ull("NBBS_NUM_LEVELS", NUM_LEVELS);
+	
+	hugepage_init();
+	decommit_init();
+	if(!numa_init(levels, min, max)){
 		puts("Failing allocating structures\n");
 		abort();
 	}
-	
-	init_tree(number_of_nodes);
+	arena_init();
+	magazine_init();
+	search_init();
+	scan_init();
+	backoff_init();
+	slab_init();
+	stats_init();
+	scavenger_start();
 				
+#ifdef BD_QUIET
+	return;
+#endif
 #ifdef BD_SPIN_LOCK
-	printf("4lvl-sl: UMA Init complete\n");
+	printf("4lvl-sl: %s Init complete\n", numa_nodes > 1 ? "NUMA" : "UMA");
 #else
-	printf("4lvl-nb: UMA Init complete\n");
+	printf("4lvl-nb: %s Init complete\n", numa_nodes > 1 ? "NUMA" : "UMA");
 #endif
-	printf("\t Total Memory = %lluB, %.0fKB, %.0fMB, %.0fGB\n", overall_memory_size, overall_memory_size/1024.0, overall_memory_size/1048576.0, overall_memory_size/1073741824.0);
-	printf("\t Levels = %10llu\n", overall_height);
-	printf("\t Leaves = %10llu\n", (number_of_nodes+1)/2);
-	printf("\t Nodes  = %10llu\n", number_of_nodes);
-	printf("\t Containers = %llu\n", number_of_container);
-	printf("\t Min size %12lluB, %.0fKB, %.0fMB, %.0fGB at level %2llu\n", MIN_ALLOCABLE_BYTES, MIN_ALLOCABLE_BYTES/1024.0, MIN_ALLOCABLE_BYTES/1048576.0, MIN_ALLOCABLE_BYTES/1073741824.0, overall_height);
-	printf("\t Max size %12lluB, %.0fKB, %.0fMB, %.0fGB at level %2llu\n", MAX_ALLOCABLE_BYTES, MAX_ALLOCABLE_BYTES/1024.0, MAX_ALLOCABLE_BYTES/1048576.0, MAX_ALLOCABLE_BYTES/1073741824.0, overall_height - log2_(MAX_ALLOCABLE_BYTES/MIN_ALLOCABLE_BYTES));
-	printf("\t Max allocable level %2llu\n", max_level);
-	
+	if(numa_nodes > 1)
+		printf("\t NUMA instances = %u, %s\n", numa_nodes, numa_bound ? "bound" : "not bound");
+	printf("\t Total Memory = %lluB, %.0fKB, %.0fMB, %.0fGB\n", h->overall_memory_size, h->overall_memory_size/1024.0, h->overall_memory_size/1048576.0, h->overall_memory_size/1073741824.0);
+	printf("\t Levels = %10llu\n", h->overall_height);
+	printf("\t Leaves = %10llu\n", (h->number_of_nodes+1)/2);
+	printf("\t Nodes  = %10llu\n", h->number_of_nodes);
+	printf("\t Containers = %llu\n", h->number_of_container);
+	printf("\t Min size %12lluB, %.0fKB, %.0fMB, %.0fGB at level %2llu\n", h->min_size, h->min_size/1024.0, h->min_size/1048576.0, h->min_size/1073741824.0, h->overall_height);
+	printf("\t Max size %12lluB, %.0fKB, %.0fMB, %.0fGB at level %2llu\n", h->max_size, h->max_size/1024.0, h->max_size/1048576.0, h->max_size/1073741824.0, h->max_level);
+	printf("\t Max allocable level %2llu\n", h->max_level);
+	if(magazine_rounds)
+		printf("\t Magazine = %llu blocks per order\n", magazine_rounds);
+	hugepage_report();
+	if(h->idle != NULL)
+		printf("\t Decommit = blocks of %lluKB or more%s\n", h->chunk_size/1024, scavenge_period ? ", scavenger on" : "");
+	if(search_mode == SEARCH_GUIDED)
+		printf("\t Search = guided\n");
+	if(scan_mode != SCAN_SCALAR)
+		printf("\t Container scan = %s\n", scan_mode == SCAN_AVX512 ? "AVX-512" : "AVX2");
+	if(backoff_policy != BACKOFF_NONE)
+		printf("\t Backoff = %s\n", backoff_names[backoff_policy]);
+	if(slab_mode)
+		printf("\t Slab = blocks of %lluKB\n", slab_bytes(h)/1024);
+	if(arena_limit)
+		printf("\t Arenas = up to %llu more\n", arena_limit);
+	if(stats_mode)
+		printf("\t Stats = on\n");
 }
 
 __attribute__((constructor(500))) void pre_init() {
@@ -286,10 +401,278 @@ __attribute__((destructor)) void end(){
 	//free(overall_memory);
 	//free(containers);
 	//free(tree);
-#ifdef DEBUG
-	//free(node_allocated);
-	//free(size_allocated);
-#endif
+}
+
+
+//MARK: ISTANZE
+
+/*
+ Crea un'istanza che gestisce size byte, dalla quale si possono allocare blocchi tra min e max byte. Le taglie sono arrotondate a potenze di due.
+ @return l'istanza; NULL se la forma richiesta non è valida
+ */
+nbbs* nbbs_create(size_t size, size_t min, size_t max){
+	nbbs *h;
+	
+	if(min == 0 || size < min)
+		return NULL;
+	
+	h = mmap(NULL, sizeof(nbbs), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(h == MAP_FAILED)
+		return NULL;
+	
+	if(!nbbs_init(h, 1 + log2_(size/upper_power_of_two(min)), min, max, -1)){
+		munmap(h, sizeof(nbbs));
+		return NULL;
+	}
+	return h;
+}
+
+/*
+ Distrugge un'istanza. Tutti i blocchi allocati da essa diventano invalidi.
+ */
+void nbbs_destroy(nbbs *h){
+	if(h == NULL || numa_is_default(h))
+		return;
+	nbbs_fini(h);
+	munmap(h, sizeof(nbbs));
+}
+
+/*
+ Restituisce l'istanza usata da bd_xx_malloc e bd_xx_free sul nodo NUMA del thread chiamante.
+ */
+nbbs* nbbs_default(){
+	return &numa_heap[numa_local()];
+}
+
+/*
+ Restituisce l'impronta in memoria di un'istanza.
+ @param committed: parte della memoria gestita coperta da pagine fisiche, può essere NULL
+ @param reserved: dimensione della memoria gestita, può essere NULL
+ */
+void nbbs_footprint(nbbs *h, size_t *committed, size_t *reserved){
+	if(committed) *committed = decommit_resident(h->overall_memory, h->overall_memory_size);
+	if(reserved)  *reserved  = h->overall_memory_size;
+}
+
+/*
+ Restituisce l'impronta in memoria delle istanze usate da bd_xx_malloc e bd_xx_free.
+ */
+void bd_xx_footprint(size_t *committed, size_t *reserved){
+	size_t c = 0, r = 0, tc, tr;
+	unsigned int i;
+	
+	for(i = 0; i < NB_LOAD_ACQUIRE(&numa_instances); i++){
+		nbbs_footprint(numa_slot[i], &tc, &tr);
+		c += tc;
+		r += tr;
+	}
+	if(committed) *committed = c;
+	if(reserved)  *reserved  = r;
+}
+
+/*
+ Somma i contatori di tutti i thread, mentre questi continuano a lavorare (vedi ../stats.h).
+ @param stats: struttura in cui vengono scritti i contatori
+ */
+void nbbs_stats(struct nbbs_stats *stats){
+	stats_merge(stats);
+}
+
+/*
+ Legge lo spazio libero di un'istanza con una visita dell'albero che non ferma i thread: il risultato è approssimato (vedi ../frag.h).
+ @param frag: struttura in cui vengono scritti i blocchi liberi per ordine e l'indice di frammentazione
+ @param depth: livello più profondo visitato, 0 per tutto l'albero
+ @param largest: largest[i] riceve l'ordine del blocco libero più grande sotto l'i-esimo nodo al livello max_level
+ @param count: numero di elementi di largest
+ @return il numero di nodi al livello max_level
+ */
+unsigned long long nbbs_frag(nbbs *h, struct nbbs_frag *frag, unsigned long long depth, unsigned char *largest, unsigned long long count){
+	unsigned long long roots;
+	
+	memset(frag, 0, sizeof(*frag));
+	roots = frag_walk(h, frag, depth, largest, count);
+	frag_index(frag, h->max_size);
+	return roots;
+}
+
+/*
+ Legge lo spazio libero di tutte le istanze usate da bd_xx_malloc e bd_xx_free.
+ @param frag: struttura in cui viene scritta la somma
+ @param depth: livello più profondo visitato, 0 per tutto l'albero
+ */
+void bd_xx_frag(struct nbbs_frag *frag, unsigned long long depth){
+	unsigned int i;
+	
+	memset(frag, 0, sizeof(*frag));
+	for(i = 0; i < NB_LOAD_ACQUIRE(&numa_instances); i++)
+		frag_walk(numa_slot[i], frag, depth, NULL, 0);
+	frag_index(frag, numa_heap[0].max_size);
+}
+
+/*
+ Restituisce la taglia del blocco allocato all'indirizzo n, come malloc_usable_size.
+ @param n: indirizzo del blocco
+ @return byte del blocco, 0 se n non è nella memoria gestita dall'istanza
+ */
+size_t nbbs_usable_size(nbbs *h, void* n){
+	if((char*) n < (char*) h->overall_memory || (char*) n >= (char*) h->overall_memory + h->overall_memory_size) return 0;
+	if(slab_object(h, n)) return slab_object_size(h, n);
+	return h->overall_memory_size >> (level_by_idx(node_idx_by_address(h, n)) - 1);
+}
+
+/*
+ Restituisce la taglia di un blocco preso con bd_xx_malloc, 0 se non viene dalle sue istanze.
+ */
+size_t bd_xx_usable_size(void* n){
+	nbbs *h = numa_heap_by_address(n);
+	
+	return h == NULL ? 0 : nbbs_usable_size(h, n);
+}
+
+/*
+ Prova prima l'istanza del nodo NUMA locale, poi le altre in ordine di distanza, poi le arene;
+ se falliscono tutte, l'heap cresce di un'arena quando può.
+ */
+void* bd_xx_malloc(size_t byte){
+	unsigned int local = numa_local(), i;
+	unsigned long long seen;
+	nbbs *h;
+	void *p;
+	
+	do{
+		seen = arena_epoch();
+		for(i = 0; i < NB_LOAD_ACQUIRE(&numa_instances); i++){
+			h = numa_instance(local, i);
+			if(arena_skip(h))
+				continue;
+			if(slab_serves(h, byte))	p = slab_malloc(h, byte);
+			else if(magazine_rounds)	p = magazine_malloc(h, byte);
+			else						p = nbbs_malloc(h, byte);
+			if(p != NULL){
+				arena_taken(h, 1);
+				return p;
+			}
+		}
+	}while(arena_grow(seen, byte));
+	return NULL;
+}
+
+/*
+ Stessa semantica di aligned_alloc: align deve essere una potenza di due non più grande del blocco più grande.
+ Il blocco si rilascia con bd_xx_free.
+ */
+void* bd_xx_aligned_alloc(size_t align, size_t byte){
+	if(align == 0 || (align & (align - 1)) != 0)
+		return NULL;
+	return bd_xx_malloc(byte < align ? align : byte);
+}
+
+/*
+ Stessa semantica di realloc: il blocco viene ridimensionato sul posto quando possibile,
+ altrimenti viene spostato in un blocco preso come da bd_xx_malloc.
+ */
+void* bd_xx_realloc(void* n, size_t byte){
+	unsigned long long old_size;
+	nbbs *h;
+	void *p;
+	
+	if(n == NULL)
+		return bd_xx_malloc(byte);
+	if(byte == 0){
+		bd_xx_free(n);
+		return NULL;
+	}
+	
+	h = numa_heap_by_address(n);
+	if(h == NULL || byte > h->max_size)
+		return NULL;
+	
+	if(slab_object(h, n)){
+		//un oggetto resta dov'è finché la sua classe non cambia
+		old_size = slab_object_size(h, n);
+		if(slab_serves(h, byte) && slab_class(byte) == slab_class(old_size))
+			return n;
+	}
+	else{
+		//un blocco che scende alla taglia di un oggetto lo diventa, come si aspetta il rilascio con taglia
+		old_size = h->overall_memory_size >> (level_by_idx(node_idx_by_address(h, n)) - 1);
+		if(!slab_serves(h, byte) && resize_in_place(h, n, byte))
+			return n;
+	}
+	
+	p = bd_xx_malloc(byte);
+	if(p != NULL){
+		memcpy(p, n, old_size < byte ? old_size : byte);
+		bd_xx_free(n);
+	}
+	return p;
+}
+
+/*
+ Il blocco torna all'istanza da cui è stato preso.
+ */
+void bd_xx_free(void* n){
+	nbbs *h;
+	
+	//NULL e gli indirizzi che l'heap non possiede vengono ignorati
+	if(n == NULL || (h = numa_heap_by_address(n)) == NULL)
+		return;
+	
+	if(slab_object(h, n))		slab_free(h, n);
+	else if(magazine_rounds)	magazine_free(h, n, level_by_idx(node_idx_by_address(h, n)));
+	else						nbbs_free(h, n);
+	arena_given(h, 1);
+}
+
+void bd_xx_free_sized(void* n, size_t byte){
+	nbbs *h;
+	
+	//NULL e gli indirizzi che l'heap non possiede vengono ignorati
+	if(n == NULL || (h = numa_heap_by_address(n)) == NULL)
+		return;
+	
+	if(slab_serves(h, byte))	slab_free(h, n);
+	else if(magazine_rounds)	magazine_free(h, n, level_by_idx(h->overall_memory_size / block_size(h, byte)));
+	else						nbbs_free_sized(h, n, byte);
+	arena_given(h, 1);
+}
+
+unsigned int bd_xx_malloc_bulk(size_t byte, unsigned int count, void **out){
+	unsigned int local = numa_local(), got = 0, i, k;
+	unsigned long long seen;
+	nbbs *h;
+	
+	//gli oggetti di uno slab si prendono uno alla volta, così il rilascio con taglia li ritrova
+	if(slab_serves(&numa_heap[0], byte)){
+		while(got < count && (out[got] = bd_xx_malloc(byte)) != NULL)
+			got++;
+		return got;
+	}
+	
+	do{
+		seen = arena_epoch();
+		for(i = 0; i < NB_LOAD_ACQUIRE(&numa_instances) && got < count; i++){
+			h = numa_instance(local, i);
+			if(arena_skip(h))
+				continue;
+			k = nbbs_malloc_bulk(h, byte, count - got, out + got);
+			arena_taken(h, k);
+			got += k;
+		}
+	}while(got < count && arena_grow(seen, byte));
+	return got;
+}
+
+void bd_xx_free_bulk(void **ptrs, unsigned int count){
+	if(slab_mode)	slab_free_bulk(ptrs, count, 0);
+	else			numa_free_bulk(ptrs, count, 0);
+	arena_given_bulk(ptrs, count);
+}
+
+void bd_xx_free_bulk_sized(void **ptrs, unsigned int count, size_t byte){
+	if(slab_mode)	slab_free_bulk(ptrs, count, byte);
+	else			numa_free_bulk(ptrs, count, byte);
+	arena_given_bulk(ptrs, count);
 }
 
 
@@ -309,65 +692,107 @@ static inline bool IS_OCCUPIED(unsigned long long val, unsigned int pos){
 }
 
 
+/*
+ Completa l'allocazione del nodo n, al livello dei blocchi di byte byte che inizia con starting_node.
+ @return l'indirizzo del blocco del nodo
+ */
+static inline void* allocated_block(nbbs *h, unsigned long long n, unsigned long long starting_node, unsigned long long byte){
+	unsigned long long leaf_position = byte*(n - starting_node)/h->min_size;
+	
+	stats_alloc(byte, 1);
+#ifndef BD_NO_FREE_TREE
+	h->free_tree[leaf_position] = level_by_idx(n);
+#endif
+	update_freemap(level_by_idx(n), starting_node+((n+1)%starting_node));
+	return ((char*) h->overall_memory) + leaf_position*h->min_size;
+}
+
+
 /*
  Funzione di malloc richiesta dall'utente.
  @param pages: memoria richiesta dall'utente
  @return l'indirizzo di memoria del nodo utilizzato per soddisfare la richiesta; NULL in caso di fallimento
  */
-void* bd_xx_malloc(size_t byte){
+void* nbbs_malloc(nbbs *h, size_t byte){
 	bool restarted = false; 
-	unsigned long long started_at, actual, starting_node, last_node, failed_at, leaf_position;
-	unsigned long long target_lvl, bunchroot_lvl;
+	unsigned long long started_at, actual, starting_node, last_node, failed_at;
+	unsigned long long target_lvl, bunchroot_lvl, seen;
 	
     if(tid == -1){
-		tid = __sync_fetch_and_add(&partecipants, 1);
+		tid = NB_FETCH_ADD(&partecipants, 1);
     }
 	
-	if(byte > MAX_ALLOCABLE_BYTES)
+	if(byte > h->max_size)
 		return NULL;
 		
 	byte = upper_power_of_two(byte);
 	
-	if(byte < MIN_ALLOCABLE_BYTES)
-		byte = MIN_ALLOCABLE_BYTES;
+	if(byte < h->min_size)
+		byte = h->min_size;
 	
-	starting_node = overall_memory_size / byte; //first node for this level
+	starting_node = h->overall_memory_size / byte; //first node for this level
 	last_node = lchild_idx_by_idx(starting_node)-1;//last node for this level
 	target_lvl = level_by_idx(starting_node);
 	bunchroot_lvl = bunchroot_lvl_by_lvl(target_lvl);
 	
+	//a questo livello non è rimasto alcun nodo libero
+	if(oom_exhausted(h, target_lvl)){
+		stats_failure(byte, 1);
+		return NULL;
+	}
+	
 	//actual è il posto in cui iniziare a cercare
 actual = get_freemap(target_lvl, last_node);
-if(!actual)	actual = started_at = starting_node + (tid) * ((last_node - starting_node + 1)/partecipants);
+if(!actual)	actual = started_at = starting_node + (tid) * ((last_node - starting_node + 1)/NB_LOAD(&partecipants));
 	//actual = started_at = starting_node + (myid) * ((last_node - starting_node + 1)/number_of_processes);
     started_at = actual;
-	//quando faccio un giro intero ritorno NULL
+	seen = scavenge_seen(h);
+	
+	//il livello viene scandito di nuovo se lo scavenger può aver tenuto un chunk nel frattempo
 	do{
-  	    BD_LOCK(&glock);
-		failed_at = alloc(actual, target_lvl, bunchroot_lvl);
-	    BD_UNLOCK(&glock);     
-		if(failed_at == 0)
-		{
-#ifdef DEBUG
-			__sync_fetch_and_add(node_allocated,1);
-			__sync_fetch_and_add(size_allocated,byte);
-#endif
-            leaf_position = byte*(actual - overall_memory_size / byte)/MIN_ALLOCABLE_BYTES;
-            free_tree[leaf_position].pos = actual;
-			update_freemap(target_lvl, starting_node+((actual+1)%starting_node));
-            //printf("leaf pos %d\n", leaf_position);
-            return ((char*) overall_memory) + leaf_position*MIN_ALLOCABLE_BYTES; //&tree[actual]
+		//discesa dalle radici guidata dai bit di occupazione
+		if(search_mode == SEARCH_GUIDED){
+			actual = guided_search(h, started_at, target_lvl);
+			if(actual != 0)
+				return allocated_block(h, actual, starting_node, byte);
+			continue;
 		}
-
-		//Questo serve per evitare tutto il sottoalbero in cui ho fallito
-		actual = (failed_at + 1) * (1 << ( target_lvl - level_by_idx(failed_at) ) );
 		
-		if(actual > last_node){ //se ho sforato riparto dal primo utile, se il primo era quello da cui avevo iniziato esco al controllo del while
-			actual = starting_node;
-			restarted = true;
-		}
-	}while(restarted == false || actual < started_at);
+		actual = started_at;
+		restarted = false;
+		//quando faccio un giro intero ritorno NULL
+		do{
+			//salto i container in cui nessun nodo del livello è allocabile; dopo il giro basta arrivare a started_at
+			actual = next_allocable(h, actual, target_lvl, restarted ? started_at - 1 : last_node);
+			if(actual == 0){
+				if(restarted)
+					break;
+				actual = starting_node;
+				restarted = true;
+				continue;
+			}
+		
+			STATS_ADD(attempts, 1);
+	  	    BD_LOCK(&h->glock);
+			failed_at = alloc(h, actual, target_lvl, bunchroot_lvl);
+		    BD_UNLOCK(&h->glock);     
+			if(failed_at == 0)
+				return allocated_block(h, actual, starting_node, byte);
+
+			//Questo serve per evitare tutto il sottoalbero in cui ho fallito
+			actual = (failed_at + 1) * (1ULL << ( target_lvl - level_by_idx(failed_at) ) );
+		
+			if(actual > last_node){ //se ho sforato riparto dal primo utile, se il primo era quello da cui avevo iniziato esco al controllo del while
+				if(restarted) //se avevo già ripreso dal primo, il salto ha scavalcato il punto di partenza
+					break;
+				actual = starting_node;
+				restarted = true;
+			}
+		}while(restarted == false || actual < started_at);
+	}while(scavenge_raced(h, &seen));
 	
+	oom_record(h, target_lvl);
+	stats_failure(byte, 1);
 	return NULL;
 }
 
@@ -423,36 +848,39 @@ static inline bool IS_ALLOCABLE(unsigned long long val, unsigned int pos){
  Con questa allocazione abbiamo che se un generico nodo è occupato, è occupato tutto il suo ramo
  nel grappolo.. cioè se per esempio è allocato uno qualsiasi 1,2,5,10 questi 5 saranno tutti e 5 flaggati come occupati.
  Vengono anche flaggati tutti i figli nello stesso grappolo ma NON i figli nei grappoli sottostanti.
- Side effect: se fallisce subito, prima di chiamare la check_parent la variabile globale failed_at_node assumerà il valore n->pos
+ Side effect: se fallisce subito, prima di chiamare la check_parent la variabile globale failed_at_node assumerà il valore n_idx
  @param n: nodo presunto libero (potrebbe essere diventato occupato concorrentemente)
  @return true se l'allocazione riesce, false altrimenti
  */
-static unsigned long long alloc(unsigned long long n_idx, unsigned long long n_lvl, unsigned long long br_lvl){
+static unsigned long long alloc(nbbs *h, unsigned long long n_idx, unsigned long long n_lvl, unsigned long long br_lvl){
+	unsigned int retries;
 	unsigned long long old_val, new_val, n_pos, *volatile val;
-	node* n_ptr = &tree[n_idx];
-	node_container *container = n_ptr->container;
+	node_container *container = &h->containers[container_idx_by_idx_and_lvl(n_idx, n_lvl)];
 	val = &container->nodes;
-	n_pos = n_ptr->container_pos;
+	n_pos = container_pos_by_idx_and_lvl(n_idx, n_lvl);
 	
+	retries = 0;
 	do{
-		new_val = old_val = *val;
+		BACKOFF_RETRY(retries);
+		new_val = old_val = NB_LOAD_ACQUIRE(val);
 		
 		if(!IS_ALLOCABLE(new_val, n_pos)){
-			return n_ptr->pos;
+			return n_idx;
 		}
 		
 		new_val = occupa_container(n_pos, new_val);
 		#ifdef BD_SPIN_LOCK
-			container->nodes = old_val = new_val;
+			NB_STORE(&container->nodes, new_val);
+			old_val = new_val;
 		#endif
-	}while(new_val!=old_val && !__sync_bool_compare_and_swap(val, old_val, new_val));
+	}while(new_val!=old_val && !NB_CAS_ACQUIRE(val, old_val, new_val));
 	
 	//if(n->container->bunch_root == &ROOT){
-	if((br_lvl) <= max_level){
+	if((br_lvl) <= h->max_level){
 		return 0;
 	}
 
-	return check_parent(n_idx, n_lvl);
+	return check_parent(h, n_idx, n_lvl);
 }
 
 
@@ -464,11 +892,10 @@ static unsigned long long alloc(unsigned long long n_idx, unsigned long long n_l
  @param n: nodo da cui iniziare la risalita (che è già marcato totalmente o parzialmente). Per costruzione della alloc, n è per forza un nodo radice di un grappolo generico (ma sicuramente non la radice)
  @return true se la funzione riesce a marcare tutti i nodi fino alla radice; false altrimenti.
  */
-static unsigned long long check_parent(unsigned long long n_idx, unsigned long long n_lvl){
+static unsigned long long check_parent(nbbs *h, unsigned long long n_idx, unsigned long long n_lvl){
+	unsigned int retries;
 	unsigned long long new_val, old_val, tmp_container_pos, p_b_pos, p_pos, p_lvl;
 	unsigned long long br_idx, br_lvl;
-	node* n2 = &tree[n_idx];
-	node* parent = n2;
 	node_container *container;
 	
 	p_pos = n_idx;
@@ -476,18 +903,20 @@ static unsigned long long check_parent(unsigned long long n_idx, unsigned long l
 	br_idx 		= bunchroot_idx_by_idx_and_lvl(p_pos, p_lvl); 
 	br_lvl 		= bunchroot_lvl_by_lvl(p_lvl);
 	do{
-		parent 		= &tree[br_idx>>1];
-		p_b_pos 	= parent->container_pos; 
-		p_pos 		= parent->pos;
+		p_pos 		= br_idx>>1;
 		p_lvl		= br_lvl-1;
-		container 	= parent->container;
+		p_b_pos 	= container_pos_by_idx_and_lvl(p_pos, p_lvl); 
+		container 	= &h->containers[container_idx_by_idx_and_lvl(p_pos, p_lvl)];
 		
+		retries = 0;
 		do{
+			BACKOFF_RETRY(retries);
 			tmp_container_pos = p_b_pos; 
-			new_val = old_val = container->nodes;
+			new_val = old_val = NB_LOAD_ACQUIRE(&container->nodes);
 			
 			if(IS_OCCUPIED(old_val, tmp_container_pos)){
-				internal_free_node(n2, br_lvl);
+				internal_free_node(h, n_idx, br_lvl);
+				STATS_ADD(rollbacks, 1);
 				return p_pos;
 			}
 			
@@ -503,17 +932,285 @@ static unsigned long long check_parent(unsigned long long n_idx, unsigned long l
 				new_val = LOCK_NOT_A_LEAF(new_val, tmp_container_pos);
 			}
 			#ifdef BD_SPIN_LOCK
-				container->nodes = old_val = new_val;
+				NB_STORE(&container->nodes, new_val);
+				old_val = new_val;
 			#endif
 
-		}while(new_val!=old_val && !__sync_bool_compare_and_swap(&(container->nodes),old_val,new_val));
+		}while(new_val!=old_val && !NB_CAS_ACQUIRE(&container->nodes,old_val,new_val));
 		br_idx 	>>= 4;
 		br_lvl	-=	4;
-	}while(br_lvl > max_level);	
+	}while(br_lvl > h->max_level);	
 	
 	return 0;
 }
 
+
+/*
+ Funzione di malloc allineata richiesta dall'utente. Un blocco è allineato alla sua taglia, quindi viene allocato il più piccolo blocco di almeno align e byte byte:
+ un rilascio con taglia nota deve indicare quella taglia.
+ @param align: allineamento richiesto, una potenza di due
+ @param byte: memoria richiesta dall'utente
+ @return l'indirizzo di memoria del nodo utilizzato per soddisfare la richiesta; NULL in caso di fallimento o se align non è una potenza di due
+ */
+void* nbbs_aligned_alloc(nbbs *h, size_t align, size_t byte){
+	if(align == 0 || (align & (align - 1)) != 0)
+		return NULL;
+	return nbbs_malloc(h, byte < align ? align : byte);
+}
+
+
+/*
+ Funzione di realloc richiesta dall'utente, con la semantica di realloc.
+ Il blocco viene ridimensionato sul posto quando possibile, altrimenti viene spostato in un nuovo blocco dell'istanza.
+ @param n: blocco da ridimensionare; se è NULL la funzione si comporta come nbbs_malloc
+ @param byte: nuova taglia; se è 0 il blocco viene liberato
+ @return l'indirizzo del blocco ridimensionato; NULL in caso di fallimento, e in quel caso n resta valido
+ */
+void* nbbs_realloc(nbbs *h, void* n, size_t byte){
+	unsigned long long old_size;
+	void *p;
+	
+	if(n == NULL)
+		return nbbs_malloc(h, byte);
+	if(byte == 0){
+		nbbs_free(h, n);
+		return NULL;
+	}
+	if(byte > h->max_size)
+		return NULL;
+	
+	old_size = h->overall_memory_size >> (level_by_idx(node_idx_by_address(h, n)) - 1);
+	if(resize_in_place(h, n, byte))
+		return n;
+	
+	p = nbbs_malloc(h, byte);
+	if(p != NULL){
+		memcpy(p, n, old_size < byte ? old_size : byte);
+		nbbs_free(h, n);
+	}
+	return p;
+}
+
+
+/*
+ Funzione di malloc multipla richiesta dall'utente: alloca fino a count blocchi della stessa taglia e li scrive in out.
+ I nodi vengono presi a gruppi di fratelli e cugini, così gli antenati comuni vengono aggiornati una sola volta per gruppo.
+ @param byte: taglia dei blocchi
+ @param count: numero di blocchi richiesti
+ @param out: array in cui vengono scritti gli indirizzi dei blocchi
+ @return il numero di blocchi allocati
+ */
+unsigned int nbbs_malloc_bulk(nbbs *h, size_t byte, unsigned int count, void **out){
+	unsigned long long claimed[1ULL << MAX_BULK_SPAN];
+	unsigned long long started_at, actual, starting_node, last_node, failed_at, leaf_position;
+	unsigned long long target_lvl, group, span, i, c, seen;
+	unsigned int got = 0;
+	bool restarted = false;
+	
+	if(tid == -1){
+		tid = NB_FETCH_ADD(&partecipants, 1);
+	}
+	
+	if(count == 0 || byte > h->max_size)
+		return 0;
+		
+	byte = upper_power_of_two(byte);
+	
+	if(byte < h->min_size)
+		byte = h->min_size;
+	
+	starting_node = h->overall_memory_size / byte; //first node for this level
+	last_node = lchild_idx_by_idx(starting_node)-1;//last node for this level
+	target_lvl = level_by_idx(starting_node);
+	
+	if(oom_exhausted(h, target_lvl)){
+		stats_failure(byte, count);
+		return 0;
+	}
+	
+	actual = get_freemap(target_lvl, last_node);
+	if(!actual)	actual = starting_node + (tid) * ((last_node - starting_node + 1)/NB_LOAD(&partecipants));
+	started_at = actual;
+	seen = scavenge_seen(h);
+	
+	//il livello viene scandito di nuovo se lo scavenger può aver tenuto un chunk nel frattempo
+	do{
+		actual = started_at;
+		restarted = false;
+		do{
+			//il gruppo è radicato span livelli sopra il livello richiesto e copre le richieste rimanenti
+			span = log2_(upper_power_of_two(count - got));
+			if(span > MAX_BULK_SPAN)				span = MAX_BULK_SPAN;
+			if(span > target_lvl - h->max_level)	span = target_lvl - h->max_level;
+			group = actual >> span;
+		
+			STATS_ADD(attempts, 1);
+			BD_LOCK(&h->glock);
+			c = alloc_group(h, group, span, target_lvl, count - got, claimed, &failed_at);
+			BD_UNLOCK(&h->glock);
+		
+			for(i=0;i<c;i++){
+				leaf_position = byte*(claimed[i] - starting_node)/h->min_size;
+	#ifndef BD_NO_FREE_TREE
+				h->free_tree[leaf_position] = target_lvl;
+	#endif
+				out[got++] = ((char*) h->overall_memory) + leaf_position*h->min_size;
+			}
+			if(c != 0)
+				stats_alloc(byte, c);
+		
+			if(got == count){
+				update_freemap(target_lvl, starting_node+((claimed[c-1]+1)%starting_node));
+				return got;
+			}
+		
+			//se è occupato un antenato del gruppo salto il suo sottoalbero, altrimenti passo al gruppo successivo
+			if(failed_at != 0 && level_by_idx(failed_at) < level_by_idx(group))
+				actual = (failed_at + 1) * (1ULL << ( target_lvl - level_by_idx(failed_at) ) );
+			else
+				actual = (group + 1) << span;
+		
+			if(actual > last_node){
+				if(restarted)
+					break;
+				actual = starting_node;
+				restarted = true;
+			}
+		}while(restarted == false || actual < started_at);
+	}while(scavenge_raced(h, &seen));
+	
+	oom_record(h, target_lvl);
+	stats_failure(byte, count - got);
+	return got;
+}
+
+
+/*
+ Prova ad allocare un gruppo di nodi al livello lvl discendenti dal nodo a, che sta span livelli più in alto.
+ I nodi dello stesso grappolo vengono presi con una sola CAS sul container. Poi i grappoli vengono marcati nei loro antenati come fa la check_parent,
+ ma un livello di grappoli alla volta: i grappoli con lo stesso container padre sono marcati con una sola CAS su quel container.
+ I nodi sotto un antenato occupato vengono rilasciati e tolti dal gruppo.
+ @param want: numero massimo di nodi da prendere
+ @param claimed: array in cui vengono scritti gli indici dei nodi presi
+ @param failed_at: se tutto il gruppo fallisce, il nodo occupato che ha fatto fallire l'allocazione
+ @return il numero di nodi presi
+ */
+static unsigned long long alloc_group(nbbs *h, unsigned long long a, unsigned long long span, unsigned long long lvl, unsigned long long want, unsigned long long *claimed, unsigned long long *failed_at){
+	unsigned int retries;
+	unsigned long long bunches[1ULL << MAX_BULK_SPAN];
+	unsigned long long old_val, new_val, n_pos, p_pos, tmp_container_pos;
+	unsigned long long i, j, k, g, kept, start, taken, nb, c = 0;
+	unsigned long long br_lvl, p_lvl, failed_mask;
+	unsigned long long first = a << span;
+	unsigned long long last = first + (1ULL << span);
+	node_container *container;
+	
+	*failed_at = 0;
+	
+	//FASE 1: prendo i nodi richiesti, una CAS per grappolo
+	for(i=first; i<last && c<want; ){
+		container = &h->containers[container_idx_by_idx_and_lvl(i, lvl)];
+		start = i;
+		while(i<last && bunchroot_idx_by_idx_and_lvl(i, lvl) == bunchroot_idx_by_idx_and_lvl(start, lvl)) i++;
+		
+		retries = 0;
+		do{
+			BACKOFF_RETRY(retries);
+			new_val = old_val = NB_LOAD_ACQUIRE(&container->nodes);
+			taken = 0;
+			for(k=start; k<i && c+taken<want; k++){
+				n_pos = container_pos_by_idx_and_lvl(k, lvl);
+				if(IS_ALLOCABLE(new_val, n_pos)){
+					new_val = occupa_container(n_pos, new_val);
+					claimed[c+taken++] = k;
+				}
+			}
+			#ifdef BD_SPIN_LOCK
+				NB_STORE(&container->nodes, new_val);
+				old_val = new_val;
+			#endif
+		}while(new_val!=old_val && !NB_CAS_ACQUIRE(&container->nodes, old_val, new_val));
+		c += taken;
+	}
+	
+	if(c == 0)
+		return 0;
+	
+	//FASE 2: marco gli antenati, un livello di grappoli alla volta
+	br_lvl = bunchroot_lvl_by_lvl(lvl);
+	for(i=0, nb=0; i<c; i++){
+		k = bunchroot_idx_by_idx_and_lvl(claimed[i], lvl);
+		if(nb == 0 || bunches[nb-1] != k) bunches[nb++] = k;
+	}
+	
+	while(br_lvl > h->max_level){
+		p_lvl = br_lvl-1;
+		for(i=0, j=0; i<nb; ){
+			//bunches[i]>>4 è la radice del container del padre
+			container = &h->containers[container_idx_by_idx_and_lvl(bunches[i]>>1, p_lvl)];
+			start = i;
+			while(i<nb && (bunches[i]>>4) == (bunches[start]>>4)) i++;
+			
+			retries = 0;
+			do{
+				BACKOFF_RETRY(retries);
+				new_val = old_val = NB_LOAD_ACQUIRE(&container->nodes);
+				failed_mask = 0;
+				for(g=start; g<i; g++){
+					tmp_container_pos = p_pos = container_pos_by_idx_and_lvl(bunches[g]>>1, p_lvl);
+					
+					if(IS_OCCUPIED(old_val, p_pos)){
+						failed_mask |= 1ULL << (g-start);
+						continue;
+					}
+					
+					if(is_left_by_idx(bunches[g])){
+						new_val = CLEAN_LEFT_COALESCE(new_val, p_pos);
+						new_val = OCCUPY_LEFT(new_val, p_pos);
+					}else{
+						new_val = CLEAN_RIGHT_COALESCE(new_val, p_pos);
+						new_val = OCCUPY_RIGHT(new_val, p_pos);
+					}
+					
+					while((tmp_container_pos >>= 1) != 0){
+						new_val = LOCK_NOT_A_LEAF(new_val, tmp_container_pos);
+					}
+				}
+				#ifdef BD_SPIN_LOCK
+					NB_STORE(&container->nodes, new_val);
+					old_val = new_val;
+				#endif
+			}while(new_val!=old_val && !NB_CAS_ACQUIRE(&container->nodes, old_val, new_val));
+			
+			//rilascio i nodi sotto i padri occupati
+			if(failed_mask != 0){
+				for(k=0, kept=0; k<c; k++){
+					p_pos = claimed[k] >> (lvl - br_lvl);
+					for(g=start; g<i && bunches[g]!=p_pos; g++);
+					if(g<i && (failed_mask & (1ULL << (g-start))) != 0){
+						internal_free_node(h, claimed[k], br_lvl);
+						STATS_ADD(rollbacks, 1);
+					}
+					else
+						claimed[kept++] = claimed[k];
+				}
+				if((c = kept) == 0){
+					*failed_at = bunches[start + __builtin_ctzll(failed_mask)] >> 1;
+					return 0;
+				}
+			}
+			
+			//il grappolo padre va marcato al giro successivo
+			if(failed_mask != (1ULL << (i-start)) - 1)
+				bunches[j++] = bunches[start] >> 4;
+		}
+		nb = j;
+		br_lvl -= 4;
+	}
+	
+	return c;
+}
+
 //MARK: FREE
 
 
@@ -546,20 +1243,86 @@ static inline unsigned long long libera_container(unsigned long long n_pos, unsi
 }
 
 
-void bd_xx_free(void* n){
-    unsigned long long tmp = ((unsigned long long)n) - (unsigned long long)overall_memory;
-    unsigned long long pos = (unsigned long long) tmp;
-    pos = pos / MIN_ALLOCABLE_BYTES;
-    pos = free_tree[pos].pos;
+void nbbs_free(nbbs *h, void* n){
+    unsigned long long pos;
+	
+	if(n == NULL)
+		return;
+    pos = node_idx_by_address(h, n);
+    decommit_release(h, n, h->overall_memory_size >> (level_by_idx(pos) - 1));
+	stats_free(h->overall_memory_size >> (level_by_idx(pos) - 1));
     update_freemap(level_by_idx(pos), pos);
-    BD_LOCK(&glock);
-    internal_free_node(&tree[pos], max_level);
-	BD_UNLOCK(&glock);
+    BD_LOCK(&h->glock);
+    internal_free_node(h, pos, h->max_level);
+	BD_UNLOCK(&h->glock);
+}
 
-#ifdef DEBUG
-	__sync_fetch_and_add(node_allocated,-1);
-	__sync_fetch_and_add(size_allocated,-(n->mem_size));
-#endif
+
+/*
+ Funzione di free richiesta dall'utente quando la taglia del blocco è nota: il nodo allocato viene calcolato
+ dall'indirizzo e dalla taglia, senza leggere la free_tree.
+ @param byte: taglia richiesta alla malloc
+ */
+void nbbs_free_sized(nbbs *h, void* n, size_t byte){
+	unsigned long long pos;
+	
+	if(n == NULL)
+		return;
+	pos = node_idx_by_address_and_size(h, n, block_size(h, byte));
+	decommit_release(h, n, block_size(h, byte));
+	stats_free(block_size(h, byte));
+	update_freemap(level_by_idx(pos), pos);
+	BD_LOCK(&h->glock);
+	internal_free_node(h, pos, h->max_level);
+	BD_UNLOCK(&h->glock);
+}
+
+
+/*
+ Funzione di free multipla richiesta dall'utente.
+ @param ptrs: array degli indirizzi da liberare
+ @param count: numero di indirizzi in ptrs
+ */
+void nbbs_free_bulk(nbbs *h, void **ptrs, unsigned int count){
+	free_bulk(h, ptrs, count, 0);
+}
+
+
+/*
+ Funzione di free multipla richiesta dall'utente per blocchi che hanno tutti la stessa taglia nota.
+ @param byte: taglia richiesta alla malloc
+ */
+void nbbs_free_bulk_sized(nbbs *h, void **ptrs, unsigned int count, size_t byte){
+	free_bulk(h, ptrs, count, block_size(h, byte));
+}
+
+
+/*
+ Free multipla. I nodi vengono ordinati, così quelli che hanno antenati in comune
+ vengono liberati insieme e ogni antenato condiviso viene visitato una sola volta.
+ @param byte: taglia di tutti i blocchi; se è 0 i nodi vengono letti dalla free_tree
+ */
+static void free_bulk(nbbs *h, void **ptrs, unsigned int count, unsigned long long byte){
+	unsigned long long nodes[1ULL << MAX_BULK_SPAN];
+	unsigned long long i, n;
+	
+	while(count > 0){
+		n = count < (1ULL << MAX_BULK_SPAN) ? count : (1ULL << MAX_BULK_SPAN);
+		for(i = 0; i < n; i++){
+			nodes[i] = byte ? node_idx_by_address_and_size(h, ptrs[i], byte) : node_idx_by_address(h, ptrs[i]);
+			decommit_release(h, ptrs[i], h->overall_memory_size >> (level_by_idx(nodes[i]) - 1));
+			stats_free(h->overall_memory_size >> (level_by_idx(nodes[i]) - 1));
+			update_freemap(level_by_idx(nodes[i]), nodes[i]);
+		}
+		sort_desc_ull(nodes, n);
+		
+		BD_LOCK(&h->glock);
+		internal_free_group(h, nodes, n, h->max_level);
+		BD_UNLOCK(&h->glock);
+		
+		ptrs  += n;
+		count -= n;
+	}
 }
 
 
@@ -573,27 +1336,33 @@ void bd_xx_free(void* n){
 	3) vengo smarcati i grappoli antecedenti (funzione smarca)
  @param n è un nodo generico ma per come facciamo qui la allocazione tutto il suo ramo è marcato.
 */
-static void internal_free_node(node* n, unsigned long long upper_bound){
-	unsigned long long old_val, new_val, p_pos, n_pos;
+static void internal_free_node(nbbs *h, unsigned long long n, unsigned long long upper_bound){
+	unsigned int retries;
+	unsigned long long old_val, new_val, n_pos, lvl = level_by_idx(n);
+	node_container *container = &h->containers[container_idx_by_idx_and_lvl(n, lvl)];
 	bool do_exit = false;
 	
 	
 	// FASE 1
-	if(level_by_idx(BUNCHROOT(n)->pos) > upper_bound)//TODO: sistemare marca per togliere il controllo qui
-		marca(BUNCHROOT(n), upper_bound);
+	if(bunchroot_lvl_by_lvl(lvl) > upper_bound)//TODO: sistemare marca per togliere il controllo qui
+		marca(h, BUNCHROOT(n), upper_bound);
 	// FASE 2
+	n_pos = container_pos_by_idx_and_lvl(n, lvl);
+	retries = 0;
 	do{
-		n_pos = p_pos = n->container_pos; 
-		old_val = new_val = n->container->nodes;
+		BACKOFF_RETRY(retries);
+		old_val = new_val = NB_LOAD_ACQUIRE(&container->nodes);
 		new_val = libera_container(n_pos, new_val, &do_exit);
 		#ifdef BD_SPIN_LOCK
-		n->container->nodes = old_val = new_val;
+		NB_STORE(&container->nodes, new_val);
+		old_val = new_val;
 		#endif
-	}while(new_val!=old_val && !__sync_bool_compare_and_swap(&n->container->nodes,old_val, new_val));
+	}while(new_val!=old_val && !NB_CAS_ACQ_REL(&container->nodes,old_val, new_val));
 	
 	// FASE 3
-	if(level_by_idx(BUNCHROOT(n)->pos) > upper_bound && !do_exit)
-		smarca(BUNCHROOT(n), upper_bound);
+	if(bunchroot_lvl_by_lvl(lvl) > upper_bound && !do_exit)
+		smarca(h, BUNCHROOT(n), upper_bound);
+	oom_released(h);
 }
 
 
@@ -602,26 +1371,31 @@ static void internal_free_node(node* n, unsigned long long upper_bound){
  @param n è la radice di un grappolo. Bisogna settare in coalescing il padre.
  @return il valore precedente con un singolo nodo marcato come "coalescing"
  */
-static void marca(node* n, unsigned long long upper_bound){
-	node* parent = n;
-	unsigned long long old_val, new_val, p_pos;
+static void marca(nbbs *h, unsigned long long n, unsigned long long upper_bound){
+	unsigned int retries;
+	unsigned long long parent = n, old_val, new_val, p_pos;
+	node_container *container;
 	bool is_left_son;
 	do{
-		is_left_son = is_left_by_idx(BUNCHROOT(parent)->pos); 
-		parent = &parent_ptr_by_ptr(BUNCHROOT(parent));
-		p_pos = parent->container_pos;
+		is_left_son = is_left_by_idx(BUNCHROOT(parent)); 
+		parent = parent_idx_by_idx(BUNCHROOT(parent));
+		p_pos = container_pos_by_idx(parent);
+		container = container_by_idx(parent);
 		
+		retries = 0;
 		do{
-			old_val = new_val = parent->container->nodes;
+			BACKOFF_RETRY(retries);
+			old_val = new_val = NB_LOAD_ACQUIRE(&container->nodes);
 			new_val = new_val | (COALESCE_RIGHT(0, p_pos) << is_left_son);
 			if(new_val==old_val)										//SPAA2018
 				return;													//SPAA2018
 			#ifdef BD_SPIN_LOCK
-			parent->container->nodes = old_val = new_val;
+			NB_STORE(&container->nodes, new_val);
+			old_val = new_val;
 			#endif
-		}while(old_val != new_val && !__sync_bool_compare_and_swap(&parent->container->nodes, old_val, new_val));
-//		}while(new_val!=old_val && !__sync_bool_compare_and_swap(&parent->container->nodes, old_val, new_val));
-	}while(level_by_idx(BUNCHROOT(parent)->pos) > upper_bound);
+		}while(old_val != new_val && !NB_CAS_ACQ_REL(&container->nodes, old_val, new_val));
+//		}while(new_val!=old_val && !__sync_bool_compare_and_swap(&container->nodes, old_val, new_val));
+	}while(level_by_idx(BUNCHROOT(parent)) > upper_bound);
 }
 
 
@@ -631,21 +1405,24 @@ static void marca(node* n, unsigned long long upper_bound){
  @param n: n è la radice di un grappolo (BISOGNA SMARCARE DAL PADRE)
  
  */
-static void smarca(node* n, unsigned long long upper_bound){
-	unsigned long long old_val, new_val, p_pos;
+static void smarca(nbbs *h, unsigned long long n, unsigned long long upper_bound){
+	unsigned int retries;
+	unsigned long long parent = n, old_val, new_val, p_pos;
+	node_container *container;
 	bool do_exit=false, is_left_son;
-	node *parent;
-	parent = n;
 
 	do{
-		is_left_son = is_left_by_idx(BUNCHROOT(parent)->pos); 
-		parent = &parent_ptr_by_ptr(BUNCHROOT(parent));
-		p_pos = parent->container_pos;
+		is_left_son = is_left_by_idx(BUNCHROOT(parent)); 
+		parent = parent_idx_by_idx(BUNCHROOT(parent));
+		p_pos = container_pos_by_idx(parent);
+		container = container_by_idx(parent);
 			
+		retries = 0;
 		do{
+			BACKOFF_RETRY(retries);
 			do_exit = false;
 			
-			old_val = new_val = parent->container->nodes;
+			old_val = new_val = NB_LOAD_ACQUIRE(&container->nodes);
 			
 			if(is_left_son){
 				if(!IS_COALESCING_LEFT(new_val, p_pos)) //qualcuno l'ha già pulito
@@ -680,12 +1457,162 @@ static void smarca(node* n, unsigned long long upper_bound){
 				new_val = UNLOCK_NOT_A_LEAF(new_val, p_pos);
 			}while(p_pos != 1);									
 			#ifdef BD_SPIN_LOCK
-			parent_ptr_by_ptr(parent).container->nodes = old_val = new_val;
+			NB_STORE(&container->nodes, new_val);
+			old_val = new_val;
 			#endif
-		}while(new_val!=old_val && !__sync_bool_compare_and_swap(&(parent_ptr_by_ptr(parent).container->nodes), old_val, new_val));
+		}while(new_val!=old_val && !NB_CAS_ACQ_REL(&container->nodes, old_val, new_val));
+	
+	}while(level_by_idx(BUNCHROOT(parent)) > upper_bound && !do_exit);
+	
+}
+
+
+/*
+ Funzione ausiliaria a internal_free_group. Risale l'albero un livello di grappoli alla volta partendo da un insieme di radici di grappolo,
+ ordinate in modo decrescente e senza duplicati. Le radici il cui padre sta nello stesso container vengono gestite con una sola CAS.
+ @param bunches: radici dei grappoli da cui partire
+ @param coalesce: se true fa la FASE 1 della free (come marca), altrimenti la FASE 3 (come smarca)
+ */
+static void climb_bunches(nbbs *h, unsigned long long *bunches, unsigned long long count, unsigned long long upper_bound, bool coalesce){
+	unsigned int retries;
+	unsigned long long up[1ULL << MAX_BULK_SPAN], cur[1ULL << MAX_BULK_SPAN];
+	unsigned long long n_up = 0, n_cur, i, j = 0, k, start, br, br_lvl, old_val, new_val, p_pos, bit;
+	node_container *container;
+	bool climb, do_exit;
 	
-	}while(level_by_idx(BUNCHROOT(parent)->pos) > upper_bound && !do_exit);
+	if(count == 0) return;
+	br_lvl = level_by_idx(bunches[0]);
 	
+	while(br_lvl > upper_bound){
+		//unisce i grappoli che arrivano da sotto con quelli dei nodi liberati a questo livello, togliendo i duplicati
+		i = n_cur = 0;
+		while(i < n_up || (j < count && level_by_idx(bunches[j]) == br_lvl)){
+			if(j < count && level_by_idx(bunches[j]) == br_lvl && (i == n_up || bunches[j] >= up[i]))
+				br = bunches[j++];
+			else
+				br = up[i++];
+			if(n_cur == 0 || cur[n_cur-1] != br)
+				cur[n_cur++] = br;
+		}
+		
+		n_up = 0;
+		for(start = 0; start < n_cur; start = i){
+			//cur[start]>>4 è la radice del container del padre
+			for(i = start+1; i < n_cur && (cur[i] >> 4) == (cur[start] >> 4); i++);
+			container = container_by_idx(cur[start] >> 1);
+			
+			retries = 0;
+			do{
+				BACKOFF_RETRY(retries);
+				old_val = new_val = NB_LOAD_ACQUIRE(&container->nodes);
+				climb = false;
+				for(k = start; k < i; k++){
+					p_pos = container_pos_by_idx(cur[k] >> 1);
+					if(coalesce){
+						bit = COALESCE_RIGHT(0, p_pos) << is_left_by_idx(cur[k]);
+						if((old_val & bit) == 0) //se era già settato qualcun altro sta risalendo (SPAA2018)
+							climb = true;
+						new_val |= bit;
+						continue;
+					}
+					
+					if(is_left_by_idx(cur[k])){
+						if(!IS_COALESCING_LEFT(new_val, p_pos)) //qualcuno l'ha già pulito
+							continue;
+						new_val = CLEAN_LEFT_COALESCE(new_val, p_pos);
+						new_val = CLEAN_LEFT(new_val, p_pos);
+						if(IS_OCCUPIED_RIGHT(new_val, p_pos))
+							continue;
+					}
+					else{
+						if(!IS_COALESCING_RIGHT(new_val, p_pos)) //qualcuno l'ha già pulito
+							continue;
+						new_val = CLEAN_RIGHT_COALESCE(new_val, p_pos);
+						new_val = CLEAN_RIGHT(new_val, p_pos);
+						if(IS_OCCUPIED_LEFT(new_val, p_pos))
+							continue;
+					}
+					
+					do_exit = false;
+					do{
+						CHECK_BROTHER_OCCUPIED(p_pos,new_val); //questo termina il ciclo se il fratello è occupato e setta exit = true
+						p_pos/=2;
+						new_val = UNLOCK_NOT_A_LEAF(new_val, p_pos);
+					}while(p_pos != 1);
+					if(!do_exit)
+						climb = true;
+				}
+				#ifdef BD_SPIN_LOCK
+				NB_STORE(&container->nodes, new_val);
+				old_val = new_val;
+				#endif
+			}while(new_val!=old_val && !NB_CAS_ACQ_REL(&container->nodes, old_val, new_val));
+			
+			if(climb && br_lvl - LEVEL_PER_CONTAINER > upper_bound)
+				up[n_up++] = cur[start] >> 4;
+		}
+		
+		br_lvl -= LEVEL_PER_CONTAINER;
+		//salta i livelli in cui non c'è niente da fare
+		if(n_up == 0){
+			if(j == count) break;
+			br_lvl = level_by_idx(bunches[j]);
+		}
+	}
+}
+
+
+/*
+ Questa funzione fa la free di un gruppo di nodi, ordinati in modo decrescente, con le stesse 3 fasi di internal_free_node.
+ Ogni fase però visita una sola volta i container condivisi da più nodi.
+ @param nodes: indici dei nodi da liberare
+ */
+static void internal_free_group(nbbs *h, unsigned long long *nodes, unsigned long long count, unsigned long long upper_bound){
+	unsigned int retries;
+	unsigned long long bunches[1ULL << MAX_BULK_SPAN];
+	unsigned long long i, k, start, nb = 0, br, old_val, new_val;
+	node_container *container;
+	bool do_exit, reached_root;
+	
+	// FASE 1
+	for(i = 0; i < count; i++){
+		br = bunchroot_idx_by_idx_and_lvl(nodes[i], level_by_idx(nodes[i]));
+		if(level_by_idx(br) > upper_bound)
+			bunches[nb++] = br;
+	}
+	sort_desc_ull(bunches, nb);
+	climb_bunches(h, bunches, nb, upper_bound, true);
+	
+	// FASE 2: una CAS per ogni sequenza di nodi nello stesso container
+	nb = 0;
+	for(start = 0; start < count; start = i){
+		container = container_by_idx(nodes[start]);
+		for(i = start+1; i < count && container_by_idx(nodes[i]) == container; i++);
+		retries = 0;
+		do{
+			BACKOFF_RETRY(retries);
+			old_val = new_val = NB_LOAD_ACQUIRE(&container->nodes);
+			reached_root = false;
+			for(k = start; k < i; k++){
+				new_val = libera_container(container_pos_by_idx(nodes[k]), new_val, &do_exit);
+				if(!do_exit)
+					reached_root = true;
+			}
+			#ifdef BD_SPIN_LOCK
+			NB_STORE(&container->nodes, new_val);
+			old_val = new_val;
+			#endif
+		}while(new_val!=old_val && !NB_CAS_ACQ_REL(&container->nodes, old_val, new_val));
+		
+		br = bunchroot_idx_by_idx_and_lvl(nodes[start], level_by_idx(nodes[start]));
+		if(reached_root && level_by_idx(br) > upper_bound)
+			bunches[nb++] = br;
+	}
+	
+	// FASE 3
+	sort_desc_ull(bunches, nb);
+	climb_bunches(h, bunches, nb, upper_bound, false);
+	oom_released(h);
 }
 
 
@@ -744,6 +1671,257 @@ void  find_the_bug(int who){
 */
 
 
+//MARK: RIDIMENSIONAMENTO
+
+/*
+ Prende il figlio sinistro del nodo n, posseduto dal chiamante, così che poi n possa essere dimezzato dalla halve_node.
+ Se il figlio sta nello stesso container è già occupato insieme a n e non c'è niente da fare.
+ Altrimenti n è una foglia del container e il figlio è la radice del grappolo sottostante, che viene occupato.
+ Sotto un nodo allocato nessuna allocazione può riuscire, quindi il grappolo può essere occupato solo da una allocazione che fallirà su n:
+ in quel caso il chiamante può riprovare.
+ @return true se il figlio è stato preso, false altrimenti
+ */
+static bool hold_lchild(nbbs *h, unsigned long long n){
+	unsigned long long old_val, lvl = level_by_idx(n);
+	node_container *child;
+	
+	if(container_pos_by_idx_and_lvl(n, lvl) < LEAF_START_POSITION)
+		return true;
+	
+	child = &h->containers[container_idx_by_idx_and_lvl(lchild_idx_by_idx(n), lvl+1)];
+	old_val = NB_LOAD_ACQUIRE(&child->nodes);
+	return IS_ALLOCABLE(old_val, 1) && NB_CAS_ACQUIRE(&child->nodes, old_val, occupa_container(1, old_val));
+}
+
+
+/*
+ Restituisce il figlio sinistro del nodo n preso dalla hold_lchild, quando n non viene più dimezzato.
+ */
+static void unhold_lchild(nbbs *h, unsigned long long n){
+	unsigned int retries;
+	unsigned long long old_val, new_val, lvl = level_by_idx(n);
+	node_container *child;
+	bool do_exit;
+	
+	if(container_pos_by_idx_and_lvl(n, lvl) < LEAF_START_POSITION)
+		return;
+	
+	child = &h->containers[container_idx_by_idx_and_lvl(lchild_idx_by_idx(n), lvl+1)];
+	retries = 0;
+	do{
+		BACKOFF_RETRY(retries);
+		old_val = NB_LOAD_ACQUIRE(&child->nodes);
+		new_val = libera_container(1, old_val, &do_exit);
+	}while(new_val!=old_val && !NB_CAS_ACQ_REL(&child->nodes, old_val, new_val));
+}
+
+
+/*
+ Sposta l'allocazione del nodo n, posseduto dal chiamante, sul figlio sinistro, preso dalla hold_lchild, e libera il figlio destro.
+ Se il figlio sta nello stesso container basta una CAS. Altrimenti la foglia passa da occupata a parzialmente occupata a sinistra.
+ */
+static void halve_node(nbbs *h, unsigned long long n){
+	unsigned int retries;
+	unsigned long long old_val, new_val, lvl = level_by_idx(n), n_pos = container_pos_by_idx_and_lvl(n, lvl);
+	node_container *container = &h->containers[container_idx_by_idx_and_lvl(n, lvl)];
+	bool do_exit;
+	
+	retries = 0;
+	do{
+		BACKOFF_RETRY(retries);
+		old_val = NB_LOAD_ACQUIRE(&container->nodes);
+		if(n_pos < LEAF_START_POSITION)
+			new_val = occupa_container(lchild_idx_by_idx(n_pos), libera_container(n_pos, old_val, &do_exit));
+		else //la foglia resta come la lascerebbe la check_parent dopo aver allocato il figlio sinistro
+			new_val = OCCUPY_LEFT(CLEAN_LEFT_COALESCE(UNLOCK_A_LEAF(old_val, n_pos), n_pos), n_pos);
+		#ifdef BD_SPIN_LOCK
+			NB_STORE(&container->nodes, new_val);
+			old_val = new_val;
+		#endif
+	}while(new_val!=old_val && !NB_CAS_ACQ_REL(&container->nodes, old_val, new_val));
+}
+
+
+/*
+ Prende il fratello destro del nodo n, posseduto dal chiamante e figlio sinistro, come la alloc occuperebbe un nodo,
+ così che poi n possa essere raddoppiato dalla grow_node.
+ Se n non è la radice del suo grappolo il fratello sta nello stesso container, altrimenti è la radice di un altro grappolo.
+ @return true se il fratello è stato preso, false se non è libero
+ */
+static bool claim_buddy(nbbs *h, unsigned long long n){
+	unsigned int retries;
+	unsigned long long old_val, new_val, lvl = level_by_idx(n), n_pos = container_pos_by_idx_and_lvl(n, lvl);
+	node_container *container;
+	
+	if(n_pos != 1){
+		container = &h->containers[container_idx_by_idx_and_lvl(n, lvl)];
+		retries = 0;
+		do{
+			BACKOFF_RETRY(retries);
+			old_val = NB_LOAD_ACQUIRE(&container->nodes);
+			if(!IS_ALLOCABLE(old_val, n_pos+1))
+				return false;
+			new_val = occupa_container(n_pos+1, old_val);
+			#ifdef BD_SPIN_LOCK
+				NB_STORE(&container->nodes, new_val);
+				old_val = new_val;
+			#endif
+		}while(new_val!=old_val && !NB_CAS_ACQUIRE(&container->nodes, old_val, new_val));
+		return true;
+	}
+	
+	container = &h->containers[container_idx_by_idx_and_lvl(n+1, lvl)];
+	old_val = NB_LOAD_ACQUIRE(&container->nodes);
+	return IS_ALLOCABLE(old_val, 1) && NB_CAS_ACQUIRE(&container->nodes, old_val, occupa_container(1, old_val));
+}
+
+
+/*
+ Restituisce il fratello destro del nodo n preso dalla claim_buddy, quando n non viene più raddoppiato.
+ Poiché n resta occupato, la libera_container si ferma al fratello senza toccare gli antenati.
+ */
+static void unclaim_buddy(nbbs *h, unsigned long long n){
+	unsigned int retries;
+	unsigned long long old_val, new_val, lvl = level_by_idx(n), n_pos = container_pos_by_idx_and_lvl(n, lvl);
+	node_container *container = &h->containers[container_idx_by_idx_and_lvl(n+1, lvl)];
+	bool do_exit;
+	
+	retries = 0;
+	do{
+		BACKOFF_RETRY(retries);
+		old_val = NB_LOAD_ACQUIRE(&container->nodes);
+		new_val = libera_container(n_pos != 1 ? n_pos+1 : 1, old_val, &do_exit);
+		#ifdef BD_SPIN_LOCK
+			NB_STORE(&container->nodes, new_val);
+			old_val = new_val;
+		#endif
+	}while(new_val!=old_val && !NB_CAS_ACQ_REL(&container->nodes, old_val, new_val));
+}
+
+
+/*
+ Sposta l'allocazione del nodo n, posseduto dal chiamante e figlio sinistro, sul padre. Il fratello destro deve essere già stato preso dalla claim_buddy.
+ Se n non è la radice del suo grappolo padre e fratello stanno nello stesso container e basta una CAS.
+ Altrimenti il padre è una foglia del grappolo superiore e il fratello è la radice di un altro grappolo:
+ si occupa la foglia, poi i due grappoli vengono liberati perché ora stanno dentro al blocco.
+ */
+static void grow_node(nbbs *h, unsigned long long n){
+	unsigned int retries;
+	unsigned long long old_val, new_val, lvl = level_by_idx(n), n_pos = container_pos_by_idx_and_lvl(n, lvl);
+	unsigned long long p = parent_idx_by_idx(n), p_pos = container_pos_by_idx_and_lvl(p, lvl-1);
+	node_container *container = &h->containers[container_idx_by_idx_and_lvl(p, lvl-1)], *own, *sibling;
+	bool do_exit;
+	
+	if(n_pos != 1){
+		retries = 0;
+		do{
+			BACKOFF_RETRY(retries);
+			old_val = NB_LOAD_ACQUIRE(&container->nodes);
+			new_val = occupa_container(p_pos, old_val);
+			#ifdef BD_SPIN_LOCK
+				NB_STORE(&container->nodes, new_val);
+				old_val = new_val;
+			#endif
+		}while(new_val!=old_val && !NB_CAS_ACQ_REL(&container->nodes, old_val, new_val));
+		return;
+	}
+	
+	own = &h->containers[container_idx_by_idx_and_lvl(n, lvl)];
+	sibling = &h->containers[container_idx_by_idx_and_lvl(n+1, lvl)];
+	
+	//la foglia è parzialmente occupata da n, quindi nessuno può allocarla: cambiano solo i bit lasciati da una free nel fratello.
+	//I bit di coalescing vanno puliti come fa la check_parent, altrimenti la foglia resterebbe non allocabile dopo la free del blocco
+	retries = 0;
+	do{
+		BACKOFF_RETRY(retries);
+		old_val = NB_LOAD_ACQUIRE(&container->nodes);
+		new_val = occupa_container(p_pos, CLEAN_RIGHT_COALESCE(CLEAN_LEFT_COALESCE(old_val, p_pos), p_pos));
+		#ifdef BD_SPIN_LOCK
+			NB_STORE(&container->nodes, new_val);
+			old_val = new_val;
+		#endif
+	}while(new_val!=old_val && !NB_CAS_ACQ_REL(&container->nodes, old_val, new_val));
+	
+	retries = 0;
+	do{
+		BACKOFF_RETRY(retries);
+		old_val = NB_LOAD_ACQUIRE(&own->nodes);
+		new_val = libera_container(1, old_val, &do_exit);
+	}while(new_val!=old_val && !NB_CAS_ACQ_REL(&own->nodes, old_val, new_val));
+	
+	retries = 0;
+	do{
+		BACKOFF_RETRY(retries);
+		old_val = NB_LOAD_ACQUIRE(&sibling->nodes);
+		new_val = libera_container(1, old_val, &do_exit);
+	}while(new_val!=old_val && !NB_CAS_ACQ_REL(&sibling->nodes, old_val, new_val));
+}
+
+
+/*
+ Ridimensiona sul posto il blocco all'indirizzo ptr ai blocchi che servono byte byte.
+ Un blocco si riduce restituendo le sue metà destre, così che una free con taglia possa ricevere la nuova taglia;
+ cresce prendendo i suoi buddy destri, e per questo deve essere la metà sinistra di ciascun blocco più grande.
+ I nodi di tutti i livelli attraversati vengono presi prima di modificare il blocco: se uno di essi non può essere preso
+ quelli già presi vengono restituiti e il blocco resta com'era.
+ @return true se ora il blocco serve byte byte
+ */
+static bool resize_in_place(nbbs *h, void *ptr, unsigned long long byte){
+	unsigned long long n = node_idx_by_address(h, ptr), lvl = level_by_idx(n), half, m, k;
+	unsigned long long target = level_by_idx(h->overall_memory_size / block_size(h, byte));
+	unsigned long long old_size = h->overall_memory_size >> (lvl - 1);
+	unsigned int retries;
+	bool held = true, released = false;
+	
+	BD_LOCK(&h->glock);
+	if(lvl < target){
+		//una metà sinistra occupata è una allocazione che sta facendo rollback, e dura poco: la si aspetta per un tempo limitato
+		for(m = n, k = lvl; k < target && held; k++){
+			retries = 0;
+			do{
+				BACKOFF_RETRY(retries);
+			}while(!(held = hold_lchild(h, m)) && retries < RESIZE_RETRIES);
+			if(held)
+				m = lchild_idx_by_idx(m);
+		}
+		while(!held && m != n){
+			m = parent_idx_by_idx(m);
+			unhold_lchild(h, m);
+		}
+		for(; held && lvl < target; lvl++){
+			//la metà destra viene restituita, le sue pagine possono andare come per una free
+			half = h->overall_memory_size >> lvl;
+			decommit_release(h, (char*) ptr + half, half);
+			halve_node(h, n);
+			update_freemap(lvl + 1, rchild_idx_by_idx(n));
+			n = lchild_idx_by_idx(n);
+			released = true;
+		}
+	}
+	else if(lvl > target){
+		for(m = n, k = lvl; k > target && is_left_by_idx(m) && claim_buddy(h, m); k--)
+			m = parent_idx_by_idx(m);
+		while(k > target && m != n){
+			m = lchild_idx_by_idx(m);
+			unclaim_buddy(h, m);
+		}
+		for(; k == target && lvl > target; lvl--){
+			grow_node(h, n);
+			n = parent_idx_by_idx(n);
+		}
+	}
+	BD_UNLOCK(&h->glock);
+	
+	if(released)
+		oom_released(h);
+	if((h->overall_memory_size >> (lvl - 1)) != old_size) stats_resize(old_size, h->overall_memory_size >> (lvl - 1));
+#ifndef BD_NO_FREE_TREE
+	h->free_tree[(((unsigned long long)ptr) - (unsigned long long)h->overall_memory) / h->min_size] = lvl;
+#endif
+	return lvl == target;
+}
+
+
 //MARK: WRITE SU FILE
 
 /* 
@@ -858,3 +2036,56 @@ unsigned int count_occupied_leaves(){
 }
 */
 
+
+/*
+ Prende un nodo dell'albero per conto dello scavenger.
+ @return false se il nodo non è libero
+ */
+static bool claim_node(nbbs *h, unsigned long long n){
+	unsigned long long failed_at, lvl = level_by_idx(n);
+	
+	BD_LOCK(&h->glock);
+	failed_at = alloc(h, n, lvl, bunchroot_lvl_by_lvl(lvl));
+	BD_UNLOCK(&h->glock);
+	return failed_at == 0;
+}
+
+/*
+ Restituisce un nodo preso con claim_node.
+ */
+static void release_node(nbbs *h, unsigned long long n){
+	BD_LOCK(&h->glock);
+	internal_free_node(h, n, h->max_level);
+	BD_UNLOCK(&h->glock);
+}
+
+
+/*
+ Classifica un nodo per la ricerca guidata a partire dai suoi bit nel container.
+ Le posizioni interne del container hanno un solo bit, che non distingue un nodo occupato da uno parzialmente occupato:
+ in quel caso la ricerca scende e trova occupate le foglie del container.
+ */
+static inline unsigned int node_state(nbbs *h, unsigned long long n, unsigned long long lvl){
+	unsigned long long val = NB_LOAD(&h->containers[container_idx_by_idx_and_lvl(n, lvl)].nodes), pos = container_pos_by_idx_and_lvl(n, lvl), bits;
+	
+	if(pos < LEAF_START_POSITION)
+		return (val & (LOCK_NOT_LEAF_MASK << (pos-1))) != 0 ? NODE_PARTIAL : NODE_FREE;
+	
+	bits = BITMASK_LEAF(val, pos);
+	if((bits & (LOCK_LEAF ^ LEFT ^ RIGHT)) != 0)
+		return NODE_FULL;
+	return (bits & (LEFT | RIGHT)) != 0 ? NODE_PARTIAL : NODE_FREE;
+}
+
+/*
+ Alloca il nodo n al livello lvl per conto della ricerca guidata.
+ */
+static inline unsigned long long try_alloc(nbbs *h, unsigned long long n, unsigned long long lvl){
+	unsigned long long failed_at;
+	
+	STATS_ADD(attempts, 1);
+	BD_LOCK(&h->glock);
+	failed_at = alloc(h, n, lvl, bunchroot_lvl_by_lvl(lvl));
+	BD_UNLOCK(&h->glock);
+	return failed_at;
+}
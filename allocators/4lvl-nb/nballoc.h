@@ -44,6 +44,9 @@
 
 #define PAGE_SIZE (4096)
 
+//#define BD_NO_FREE_TREE //senza free_tree: si possono usare solo le free con la taglia
+//#define BD_QUIET //non stampa la forma dell'istanza di default all'avvio
+
 
 typedef unsigned long long nbint; 
 
@@ -60,15 +63,78 @@ typedef struct _taken_list{
 
 
 extern __thread unsigned int myid;
-extern unsigned long long number_of_leaves;
+
+/*
+ I parametri qui sopra descrivono solo l'istanza di default usata da bd_xx_malloc/bd_xx_free.
+ Possono essere cambiati a runtime con le variabili d'ambiente NBBS_MIN, NBBS_MAX e NBBS_NUM_LEVELS.
+ Altre istanze di forma qualsiasi si creano con nbbs_create.
+ */
+typedef struct _nbbs nbbs;
 
 void  bd_xx_free(void* n);
 void* bd_xx_malloc(size_t pages);
-
-
-#ifdef DEBUG
-extern unsigned long long *node_allocated, *size_allocated;
-#endif
+void* bd_xx_aligned_alloc(size_t align, size_t bytes);
+unsigned int bd_xx_malloc_bulk(size_t bytes, unsigned int count, void **out);
+void  bd_xx_free_bulk(void **ptrs, unsigned int count);
+void  bd_xx_free_sized(void* n, size_t bytes);
+void  bd_xx_free_bulk_sized(void **ptrs, unsigned int count, size_t bytes);
+void* bd_xx_realloc(void* n, size_t bytes);
+void  bd_xx_footprint(size_t *committed, size_t *reserved);
+size_t bd_xx_usable_size(void* n);
+
+nbbs* nbbs_create(size_t size, size_t min, size_t max);
+void  nbbs_destroy(nbbs *h);
+void* nbbs_malloc(nbbs *h, size_t bytes);
+void* nbbs_aligned_alloc(nbbs *h, size_t align, size_t bytes);
+void  nbbs_free(nbbs *h, void* n);
+unsigned int nbbs_malloc_bulk(nbbs *h, size_t bytes, unsigned int count, void **out);
+void  nbbs_free_bulk(nbbs *h, void **ptrs, unsigned int count);
+void  nbbs_free_sized(nbbs *h, void* n, size_t bytes);
+void  nbbs_free_bulk_sized(nbbs *h, void **ptrs, unsigned int count, size_t bytes);
+void* nbbs_realloc(nbbs *h, void* n, size_t bytes);
+void  nbbs_footprint(nbbs *h, size_t *committed, size_t *reserved);
+size_t nbbs_usable_size(nbbs *h, void* n);
+nbbs* nbbs_default();
+
+
+/*
+ Contatori delle operazioni su tutti gli alberi, tenuti da ogni thread e sommati da nbbs_stats (vedi ../stats.h).
+ L'ordine di un blocco è il log2 della sua taglia.
+ */
+#define NBBS_STATS_ORDERS 64
+
+struct nbbs_stats{
+	unsigned long long allocs[NBBS_STATS_ORDERS];	//blocchi presi, per ordine
+	unsigned long long frees[NBBS_STATS_ORDERS];	//blocchi rilasciati, per ordine
+	unsigned long long failures[NBBS_STATS_ORDERS];	//richieste che non hanno trovato un blocco libero, per ordine
+	unsigned long long attempts;					//nodi provati dalle allocazioni; diviso i blocchi presi dà i tentativi per successo
+	unsigned long long cas_retries;					//CAS sull'albero ripetute dopo un fallimento
+	unsigned long long rollbacks;					//nodi presi e restituiti perché un antenato era occupato
+	long long bytes_in_use;							//byte dei blocchi presi e non rilasciati
+	unsigned int threads;							//blocchi di contatori, cioè il massimo numero di thread vivi insieme
+};
+
+void  nbbs_stats(struct nbbs_stats *stats);
+
+/*
+ Spazio libero di un albero, letto da una visita fino al livello depth (0 per tutto l'albero)
+ che non blocca le allocazioni (vedi ../frag.h).
+ nbbs_frag imposta anche largest[i], per i minore di count, all'ordine del blocco libero più grande
+ sotto l'i-esimo nodo al livello dei blocchi più grandi, NBBS_FRAG_FULL se non ce n'è nessuno,
+ e restituisce il numero di quei nodi.
+ */
+#define NBBS_FRAG_FULL 0xFF
+
+struct nbbs_frag{
+	unsigned long long free_blocks[NBBS_STATS_ORDERS];	//blocchi liberi che non fanno parte di uno libero più grande, per ordine
+	unsigned long long free_bytes;					//byte di quei blocchi
+	unsigned long long largest;						//byte del più grande
+	unsigned long long unwalked;					//nodi parzialmente occupati all'ultimo livello visitato, i cui blocchi liberi non sono contati
+	double fragmentation;							//indice di frammentazione esterna, la parte di free_bytes fuori dai blocchi della taglia massima
+};
+
+unsigned long long nbbs_frag(nbbs *h, struct nbbs_frag *frag, unsigned long long depth, unsigned char *largest, unsigned long long count);
+void  bd_xx_frag(struct nbbs_frag *frag, unsigned long long depth);
 
 
 #ifndef BD_SPIN_LOCK
@@ -0,0 +1,198 @@
+/**
+* This is free software;
+* You can redistribute it and/or modify this file under the
+* terms of the GNU General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+*
+* This file is distributed in the hope that it will be useful, but WITHOUT ANY
+* WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+* A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with
+* this file; if not, write to the Free Software Foundation, Inc.,
+* 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*
+* Copyright (c) 2017
+*
+*
+* Romolo Marotta
+* Mauro Ianni
+* Andrea Scarselli
+*
+*
+* This file implements the vectorised scan of the containers (4lvl).
+*
+*/
+
+#ifndef __4LVL_SCAN__
+#define __4LVL_SCAN__
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_SIMD
+#include <immintrin.h>
+#endif
+
+/*
+ I nodi di un livello stanno in container consecutivi: 2^k nodi per container, nelle posizioni da 2^k a 2^(k+1)-1, con k = (lvl-1)&3.
+ Prima di provare la alloc su un candidato, la nbbs_malloc salta i container in cui nessuno di quei nodi è allocabile.
+ Con AVX-512 o AVX2 si controllano 8 o 4 container per iterazione, altrimenti uno alla volta: l'implementazione è scelta
+ all'avvio in base alla CPU e NBBS_SIMD=0 forza quella scalare. Fuori da x86 (SCAN_SIMD non definita) c'è solo quella scalare.
+ La lettura dei container è solo un suggerimento: un container visto pieno viene saltato, come se la alloc su di esso fosse fallita.
+ Le letture vettoriali non sono atomiche per il modello di memoria del C11, anche se su x86 ogni parola allineata è letta intera:
+ con ThreadSanitizer si usa sempre la scansione scalare, che fa letture atomiche rilassate.
+*/
+
+#define SCAN_SCALAR		(0ULL)
+#define SCAN_AVX2		(1ULL)
+#define SCAN_AVX512		(2ULL)
+
+#define LEAF_GROUPS			(0x842108421ULL) //il bit più basso di ognuno degli 8 gruppi da 5 bit delle foglie
+#define CONTAINER_STRIDE	(sizeof(node_container)/sizeof(unsigned long long)) //distanza tra due container, in parole
+
+
+static unsigned long long scan_mode = SCAN_SCALAR;
+static unsigned long long scan_containers_scalar(node_container *c, unsigned long long count, unsigned long long shift, unsigned long long mask);
+static unsigned long long (*scan_containers)(node_container *c, unsigned long long count, unsigned long long shift, unsigned long long mask) = scan_containers_scalar;
+
+
+/*
+ Calcola quali nodi di un livello sono allocabili in un container.
+ @param shift: LEAF_START_POSITION-1 per le foglie, altrimenti il bit del primo nodo del livello
+ @param mask: LEAF_GROUPS per le foglie, altrimenti un bit per ogni nodo del livello
+ @return un bit acceso per ogni nodo allocabile: il bit j per il nodo j-esimo, il bit 5j per le foglie
+ */
+static inline unsigned long long allocable_mask(unsigned long long val, unsigned long long shift, unsigned long long mask){
+	val >>= shift;
+	//una foglia è allocabile solo se tutti i suoi 5 bit sono a zero: li raccolgo nel bit più basso del gruppo
+	if(mask == LEAF_GROUPS)
+		val |= (val >> 1) | (val >> 2) | (val >> 3) | (val >> 4);
+	return ~val & mask;
+}
+
+
+/*
+ Cerca il primo di count container consecutivi con almeno un nodo allocabile, uno alla volta.
+ @return la sua posizione tra i count container; count se non ce ne sono
+ */
+static unsigned long long scan_containers_scalar(node_container *c, unsigned long long count, unsigned long long shift, unsigned long long mask){
+	unsigned long long i;
+
+	for(i = 0; i < count; i++)
+		if(allocable_mask(NB_LOAD(&c[i].nodes), shift, mask) != 0)
+			return i;
+	return count;
+}
+
+
+#ifdef SCAN_SIMD
+/*
+ Come scan_containers_scalar, ma controlla 4 container per iterazione con AVX2.
+ */
+__attribute__((target("avx2")))
+static unsigned long long scan_containers_avx2(node_container *c, unsigned long long count, unsigned long long shift, unsigned long long mask){
+	const __m256i idx = _mm256_set_epi64x(3*CONTAINER_STRIDE, 2*CONTAINER_STRIDE, CONTAINER_STRIDE, 0);
+	const __m256i m = _mm256_set1_epi64x(mask);
+	const __m128i s = _mm_cvtsi64_si128(shift);
+	unsigned long long i;
+	__m256i v;
+
+	for(i = 0; i + 4 <= count; i += 4){
+		if(CONTAINER_STRIDE == 1)
+			v = _mm256_loadu_si256((const __m256i*) &c[i].nodes);
+		else
+			v = _mm256_i64gather_epi64((const long long*) &c[i].nodes, idx, 8);
+		v = _mm256_srl_epi64(v, s);
+		if(mask == LEAF_GROUPS)
+			v = _mm256_or_si256(_mm256_or_si256(v, _mm256_srli_epi64(v, 1)), _mm256_or_si256(_mm256_or_si256(_mm256_srli_epi64(v, 2), _mm256_srli_epi64(v, 3)), _mm256_srli_epi64(v, 4)));
+		//testc è vero se ~v & m è tutto a zero, cioè se nessuno dei 4 container ha un nodo allocabile
+		if(!_mm256_testc_si256(v, m))
+			break;
+	}
+	return i + scan_containers_scalar(c + i, count - i, shift, mask);
+}
+
+
+/*
+ Come scan_containers_scalar, ma controlla 8 container per iterazione con AVX-512.
+ */
+__attribute__((target("avx512f")))
+static unsigned long long scan_containers_avx512(node_container *c, unsigned long long count, unsigned long long shift, unsigned long long mask){
+	const __m512i idx = _mm512_set_epi64(7*CONTAINER_STRIDE, 6*CONTAINER_STRIDE, 5*CONTAINER_STRIDE, 4*CONTAINER_STRIDE, 3*CONTAINER_STRIDE, 2*CONTAINER_STRIDE, CONTAINER_STRIDE, 0);
+	const __m512i m = _mm512_set1_epi64(mask);
+	const __m128i s = _mm_cvtsi64_si128(shift);
+	unsigned long long i;
+	__m512i v;
+
+	for(i = 0; i + 8 <= count; i += 8){
+		if(CONTAINER_STRIDE == 1)
+			v = _mm512_loadu_si512((const void*) &c[i].nodes);
+		else
+			v = _mm512_i64gather_epi64(idx, (const void*) &c[i].nodes, 8);
+		v = _mm512_srl_epi64(v, s);
+		if(mask == LEAF_GROUPS)
+			v = _mm512_or_si512(_mm512_or_si512(v, _mm512_srli_epi64(v, 1)), _mm512_or_si512(_mm512_or_si512(_mm512_srli_epi64(v, 2), _mm512_srli_epi64(v, 3)), _mm512_srli_epi64(v, 4)));
+		v = _mm512_andnot_si512(v, m);
+		if(_mm512_test_epi64_mask(v, v) != 0)
+			break;
+	}
+	return i + scan_containers_scalar(c + i, count - i, shift, mask);
+}
+#endif
+
+
+/*
+ Sceglie l'implementazione della scansione in base alla CPU. Viene chiamata una volta dalla init.
+ */
+static void scan_init(){
+	if(getenv_ull("NBBS_SIMD", 1) == 0)
+		return;
+#ifdef SCAN_SIMD
+#ifdef __SANITIZE_THREAD__
+	return;
+#endif
+
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f")){
+		scan_containers = scan_containers_avx512;
+		scan_mode = SCAN_AVX512;
+	}
+	else if(__builtin_cpu_supports("avx2")){
+		scan_containers = scan_containers_avx2;
+		scan_mode = SCAN_AVX2;
+	}
+#endif
+}
+
+
+/*
+ Cerca il primo nodo del livello lvl tra n e last che risulta allocabile dai bit del suo container.
+ Non guarda i container degli antenati: la alloc sul nodo trovato può ancora fallire.
+ @return l'indice del nodo; 0 se nessun nodo tra n e last risulta allocabile
+ */
+static inline unsigned long long next_allocable(nbbs *h, unsigned long long n, unsigned long long lvl, unsigned long long last){
+	unsigned long long k = (lvl-1) & 3ULL, per = 1ULL << k, stride = k == 3 ? LEAF_MASK_SIZE : 1;
+	unsigned long long shift = k == 3 ? LEAF_START_POSITION-1 : per-1, mask = k == 3 ? LEAF_GROUPS : (1ULL << per)-1;
+	unsigned long long c = container_idx_by_idx_and_lvl(n, lvl), c_last = container_idx_by_idx_and_lvl(last, lvl), skipped, found;
+
+	//nel primo container contano solo i nodi da n in poi
+	found = allocable_mask(NB_LOAD(&h->containers[c].nodes), shift, mask) & ~((1ULL << (stride * (n & (per-1)))) - 1);
+	n &= ~(per-1);
+
+	if(found == 0){
+		skipped = 1 + scan_containers(&h->containers[c+1], c_last - c, shift, mask);
+		if(c + skipped > c_last)
+			return 0;
+		c += skipped;
+		n += skipped * per;
+		found = allocable_mask(NB_LOAD(&h->containers[c].nodes), shift, mask);
+		//il container è cambiato dopo la scansione: la alloc sul suo primo nodo deciderà
+		if(found == 0)
+			return n;
+	}
+
+	n += __builtin_ctzll(found) / stride;
+	return n <= last ? n : 0;
+}
+
+#endif
@@ -1,2 +1,3 @@
+#define _GNU_SOURCE
 #include "sl4lvl.h"
 #include "../4lvl-nb/nballoc.c"
\ No newline at end of file
@@ -0,0 +1,227 @@
+/**
+* This is free software;
+* You can redistribute it and/or modify this file under the
+* terms of the GNU General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+*
+* This file is distributed in the hope that it will be useful, but WITHOUT ANY
+* WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+* A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with
+* this file; if not, write to the Free Software Foundation, Inc.,
+* 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*
+* Copyright (c) 2017 - 2020
+*
+*
+* Romolo Marotta  (Contact author)
+* Mauro Ianni
+* Andrea Scarselli
+*
+*
+* This file implements the growth of the default heap by additional arenas.
+*
+*/
+
+#ifndef __NB_ARENA__
+#define __NB_ARENA__
+
+#include <sys/mman.h>
+
+
+/*
+ The default heap has a fixed size: once every instance fails a request, bd_xx_malloc returns NULL.
+ With NBBS_ARENAS=n (ARENAS at compile time) up to n more instances, the arenas, can be added
+ instead. An arena has the shape of the first instance and an independent tree, and takes the
+ next free slot of numa_slot (see numa.h): allocations try it after the NUMA instances, oldest
+ arena first, and releases find it by address range like any other instance.
+
+ Every thread that finds the heap exhausted maps a new arena in a private descriptor and tries
+ to install it in the first free slot with a CAS; the threads losing the race unmap their copy and
+ retry on the arena of the winner. Any thread can then publish the installed arena by bumping
+ numa_instances, so a thread preempted while growing stalls nobody. The epoch, the number of
+ instances plus the number of revivals, tells a thread whether the heap has grown since its last scan.
+
+ The blocks taken from each arena are counted. When the last arena in use becomes empty its
+ top-level nodes are all claimed, so that allocations skip it, and its memory is given back to
+ the OS. The counter is just a hint: if a block is still allocated a claim fails and the nodes
+ already taken are released. A retired arena is revived, before a new one is mapped, by the thread
+ clearing its flag. The arenas are unmapped only by destroy.
+
+ The including allocator has to provide nbbs_init, nbbs_fini, claim_node and release_node, and to
+ include numa.h and decommit.h first.
+ */
+
+#ifndef ARENAS                                  // Arenas added to the default heap when it is exhausted
+#define ARENAS              0ULL                // Default value: the heap does not grow
+#endif
+
+
+typedef struct _arena_count{
+    long long blocks;                           // blocks taken from the arena, not yet released
+    char pad[64 - sizeof(long long)];
+} arena_count;
+
+
+static unsigned long long arena_limit = 0;                      // number of arenas that can be added
+static unsigned long long arena_revived = 0;                    // number of revivals of a retired arena
+static unsigned int arena_retired[NUMA_MAX_NODES];              // arena_retired[i] is set if numa_slot[i] is retired
+static arena_count arena_blocks[NUMA_MAX_NODES] __attribute__((aligned(64)));
+
+
+/*
+ This function reads the number of arenas that can be added. It is called once by init, after numa_init.
+ */
+static void arena_init(){
+    arena_limit = getenv_ull("NBBS_ARENAS", ARENAS);
+    if(arena_limit > NUMA_MAX_NODES - numa_nodes) arena_limit = NUMA_MAX_NODES - numa_nodes;
+}
+
+
+/*
+ This function returns the growth epoch, to be passed to arena_grow after a failed scan of the instances.
+ Both counters only grow, so the sum changes whenever either does.
+ */
+static inline unsigned long long arena_epoch(){
+    return NB_LOAD_ACQUIRE(&numa_instances) + NB_LOAD_ACQUIRE(&arena_revived);
+}
+
+
+/*
+ This function tells whether an allocation has to skip the instance h.
+ */
+static inline bool arena_skip(nbbs *h){
+    return NB_LOAD_ACQUIRE(&arena_retired[numa_index(h)]) != 0;
+}
+
+
+/*
+ This function accounts count blocks just taken from the instance h.
+ */
+static inline void arena_taken(nbbs *h, unsigned long long count){
+    unsigned int i = numa_index(h);
+
+    if(i >= numa_nodes && count != 0) NB_FETCH_ADD(&arena_blocks[i].blocks, (long long) count);
+}
+
+
+/*
+ This function claims all the top-level nodes of the arena h and gives its memory back to the OS.
+ It returns false, with no node claimed, if a block is still allocated.
+ */
+static bool arena_claim(nbbs *h){
+    unsigned long long first = h->overall_memory_size / h->max_size, c;
+
+    for(c = 0; c < first; c++)
+        if(!claim_node(h, first + c)) break;
+
+    if(c < first){
+        while(c-- > 0) release_node(h, first + c);
+        return false;
+    }
+
+    decommit(h->overall_memory, h->overall_memory_size);
+    NB_STORE_RELEASE(&arena_retired[numa_index(h)], 1);
+    return true;
+}
+
+
+/*
+ This function gives the last arena in use back to the OS, if it is empty, and then the empty ones before it.
+ */
+static void arena_retire(nbbs *h){
+    unsigned int i = numa_index(h), n = NB_LOAD_ACQUIRE(&numa_instances), j;
+
+    // the heap shrinks from its tail only
+    for(j = i + 1; j < n; j++)
+        if(!NB_LOAD(&arena_retired[j])) return;
+
+    for(; i >= numa_nodes && NB_LOAD(&arena_blocks[i].blocks) == 0 && !NB_LOAD_ACQUIRE(&arena_retired[i]); i--)
+        if(!arena_claim(numa_slot[i])) return;
+}
+
+
+/*
+ This function accounts count blocks just released to the instance h.
+ */
+static inline void arena_given(nbbs *h, unsigned long long count){
+    unsigned int i = numa_index(h);
+
+    if(i < numa_nodes || count == 0) return;
+    if(NB_FETCH_ADD(&arena_blocks[i].blocks, -(long long) count) == (long long) count) arena_retire(h);
+}
+
+
+/*
+ This function accounts a batch of blocks just released, each to the instance owning it.
+ */
+static void arena_given_bulk(void **ptrs, unsigned int count){
+    unsigned int i;
+    nbbs *h;
+
+    if(NB_LOAD(&numa_instances) == numa_nodes) return;
+    for(i = 0; i < count; i++)
+        if((h = numa_heap_by_address(ptrs[i])) != NULL) arena_given(h, 1);
+}
+
+
+/*
+ This function publishes the arena installed in slot n, if there is one, once its windows are in the
+ range table. The slot is read with acquire, so that the release of the counter carries the descriptor
+ built by the installing thread.
+ */
+static inline void arena_publish(unsigned int n){
+    if(NB_LOAD_ACQUIRE(&numa_slot[n]) == NULL) return;
+    numa_register(n);
+    NB_CAS_RELEASE(&numa_instances, n, n + 1);
+}
+
+
+/*
+ This function grows the heap after a request of byte bytes failed on every instance. seen is the
+ epoch read before the instances were scanned. A retired arena is revived if there is one, otherwise
+ a new arena is mapped. It returns true if the request has to be retried, false if the heap cannot grow.
+ */
+static bool arena_grow(unsigned long long seen, size_t byte){
+    unsigned long long first, c;
+    unsigned int n, i;
+    numa_arena *a;
+    nbbs *h;
+
+    if(arena_limit == 0 || byte > numa_heap[0].max_size) return false;
+
+    // the heap has grown since the scan
+    if(arena_epoch() != seen) return true;
+
+    // the flag is cleared first, so that a retire running meanwhile claims the arena as a whole or not at all
+    n = NB_LOAD_ACQUIRE(&numa_instances);
+    for(i = numa_nodes; i < n; i++){
+        if(NB_LOAD(&arena_retired[i]) == 0 || !NB_CAS_ACQUIRE(&arena_retired[i], 1, 0)) continue;
+        h     = numa_slot[i];
+        first = h->overall_memory_size / h->max_size;
+        for(c = 0; c < first; c++) release_node(h, first + c);
+        NB_FETCH_ADD(&arena_revived, 1);
+        return true;
+    }
+
+    if(n - numa_nodes >= arena_limit) return false;
+
+    // only the thread installing its copy in slot n keeps it
+    a = mmap(NULL, sizeof(numa_arena), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(a != MAP_FAILED){
+        a->index = n;
+        if(!nbbs_init(&a->h, numa_heap[0].overall_height, numa_heap[0].min_size, numa_heap[0].max_size, numa_nodes > 1 ? (int) numa_local() : -1))
+            munmap(a, sizeof(numa_arena));
+        else if(!NB_CAS_RELEASE(&numa_slot[n], NULL, &a->h)){
+            nbbs_fini(&a->h);
+            munmap(a, sizeof(numa_arena));
+        }
+    }
+
+    arena_publish(n);
+    return arena_epoch() != seen;
+}
+
+#endif
@@ -0,0 +1,81 @@
+/**
+* This is free software;
+* You can redistribute it and/or modify this file under the
+* terms of the GNU General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+*
+* This file is distributed in the hope that it will be useful, but WITHOUT ANY
+* WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+* A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with
+* this file; if not, write to the Free Software Foundation, Inc.,
+* 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*
+* Copyright (c) 2017 - 2020
+*
+*
+* Romolo Marotta  (Contact author)
+* Mauro Ianni
+* Andrea Scarselli
+*
+*
+* This file implements the atomic accesses to the shared state of the NBBS allocators.
+*
+*/
+
+#ifndef __NB_ATOMICS__
+#define __NB_ATOMICS__
+
+#include <stdatomic.h>
+
+
+/*
+ The state words of the tree are plain integers, so that they can be laid out, initialised
+ and scanned freely; the macros below access them as C11 atomics with an explicit order:
+  - a claim, i.e. an allocation setting occupancy bits, is an acquire: it synchronises with the
+    releases of the nodes it takes, whose writes to the block are then visible to the new owner.
+    The loads of a claim are acquires too, since a claim that finds the bits of an ancestor
+    already set by a concurrent claim leaves it without a CAS;
+  - a release, i.e. the store that frees a node and every update of the ancestors made by a
+    release, coalescing marks included, is a release. The updates of the ancestors are acquires
+    as well, and so are the loads that precede them: an ancestor merges the state of two subtrees,
+    and the release that clears it for the next claim has to carry the earlier releases of the
+    other subtree too, which it may be the only one to have read;
+  - the other loads, i.e. the hints used to pick a candidate, are relaxed: the CAS that follows
+    checks the value again.
+ A failed CAS is relaxed, since the loop reads the word again. On x86 the RMWs are locked
+ instructions whatever their order, while acquire loads and release stores are plain moves.
+ The single store-load pattern, between the releases and the out-of-memory word (see oom.h),
+ is ordered with a sequentially consistent fence.
+ With BD_SPIN_LOCK (the -sl variants) the words are written under the global lock, which orders
+ the writers, with relaxed stores: the hints and the out-of-memory check read them without it.
+ */
+
+#define NB_ATOMIC(p)                ((_Atomic __typeof__(*(p)) *) (p))
+
+#define NB_LOAD(p)                  atomic_load_explicit(NB_ATOMIC(p), memory_order_relaxed)
+#define NB_LOAD_ACQUIRE(p)          atomic_load_explicit(NB_ATOMIC(p), memory_order_acquire)
+#define NB_STORE(p, v)              atomic_store_explicit(NB_ATOMIC(p), v, memory_order_relaxed)
+#define NB_STORE_RELEASE(p, v)      atomic_store_explicit(NB_ATOMIC(p), v, memory_order_release)
+#define NB_FETCH_ADD(p, v)          atomic_fetch_add_explicit(NB_ATOMIC(p), v, memory_order_relaxed)
+#define NB_FETCH_OR_ACQ_REL(p, v)   atomic_fetch_or_explicit(NB_ATOMIC(p), v, memory_order_acq_rel)
+#ifdef __SANITIZE_THREAD__
+// ThreadSanitizer does not support fences: a sequentially consistent RMW is a full barrier on x86 as well
+static unsigned long long nb_fence_word __attribute__((unused));
+#define NB_FENCE()                  atomic_fetch_add_explicit(NB_ATOMIC(&nb_fence_word), 0, memory_order_seq_cst)
+#else
+#define NB_FENCE()                  atomic_thread_fence(memory_order_seq_cst)
+#endif
+
+#define NB_CAS(p, old, new, order)  ({ \
+                                        __typeof__(*(p) + 0) __nb_expected = (old); \
+                                        atomic_compare_exchange_strong_explicit(NB_ATOMIC(p), &__nb_expected, new, order, memory_order_relaxed); \
+                                    })
+#define NB_CAS_ACQUIRE(p, old, new) NB_CAS(p, old, new, memory_order_acquire)
+#define NB_CAS_RELEASE(p, old, new) NB_CAS(p, old, new, memory_order_release)
+#define NB_CAS_ACQ_REL(p, old, new) NB_CAS(p, old, new, memory_order_acq_rel)
+#define NB_CAS_RELAXED(p, old, new) NB_CAS(p, old, new, memory_order_relaxed)
+
+#endif
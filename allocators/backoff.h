@@ -0,0 +1,132 @@
+/**
+* This is free software;
+* You can redistribute it and/or modify this file under the
+* terms of the GNU General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+*
+* This file is distributed in the hope that it will be useful, but WITHOUT ANY
+* WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+* A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with
+* this file; if not, write to the Free Software Foundation, Inc.,
+* 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*
+* Copyright (c) 2017 - 2020
+*
+*
+* Romolo Marotta  (Contact author)
+* Mauro Ianni
+* Andrea Scarselli
+*
+*
+* This file implements the contention management of the CAS retry loops.
+*
+*/
+
+#ifndef __NB_BACKOFF__
+#define __NB_BACKOFF__
+
+
+/*
+ Every CAS retry loop on the tree starts its body with BACKOFF_RETRY(retries), after setting
+ retries to 0: the first pass goes straight to the CAS, each further pass, which follows
+ a failed CAS, first waits according to the policy chosen with NBBS_BACKOFF (BACKOFF at
+ compile time):
+  0  none, the loop retries at once;
+  1  pause, a single pause instruction per retry;
+  2  exponential, 2^retries pauses, up to BACKOFF_CAP;
+  3  randomised, a random number of pauses below the exponential bound;
+  4  adaptive, pauses proportional to the recent failure rate of the thread's CAS loops,
+     which grows on each retry and decays on each loop entered.
+ The wait is taken before reloading the word, so that the thread does not hammer the
+ line of a hot node while the winner of the CAS still owns it.
+ */
+
+#ifndef BACKOFF                                 // Contention management policy
+#define BACKOFF             0ULL                // Default value: none
+#endif
+
+#define BACKOFF_NONE        (0ULL)
+#define BACKOFF_PAUSE       (1ULL)
+#define BACKOFF_EXP         (2ULL)
+#define BACKOFF_RANDOM      (3ULL)
+#define BACKOFF_ADAPTIVE    (4ULL)
+
+#define BACKOFF_CAP         (1024U)             // longest wait, in pause instructions
+#define BACKOFF_CAP_SHIFT   (10U)               // log2(BACKOFF_CAP)
+#define BACKOFF_RATE_ONE    (1U << 16)          // failure rate 1 in fixed point
+#define BACKOFF_RATE_SHIFT  (4U)                // weight of the last sample in the failure rate, 1/16
+
+// one spin-wait hint: pause on x86, yield on aarch64, elsewhere just a compiler barrier
+#if defined(__x86_64__) || defined(__i386__)
+#define BACKOFF_PAUSE_ONE() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define BACKOFF_PAUSE_ONE() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define BACKOFF_PAUSE_ONE() __asm__ __volatile__("" ::: "memory")
+#endif
+
+
+#define BACKOFF_RETRY(retries) do{ \
+                                if((retries)++ != 0)                            backoff_wait(retries); \
+                                else if(backoff_policy == BACKOFF_ADAPTIVE)     backoff_rate -= backoff_rate >> BACKOFF_RATE_SHIFT; \
+                            }while(0)
+
+
+static unsigned long long backoff_policy = BACKOFF_NONE;
+static const char *backoff_names[] = {"none", "pause", "exponential", "randomised", "adaptive"};
+
+static __thread unsigned int backoff_seed = 0;
+static __thread unsigned int backoff_rate = 0;
+
+
+/*
+ This function reads the contention management policy. It is called once by init.
+ */
+static void backoff_init(){
+    backoff_policy = getenv_ull("NBBS_BACKOFF", BACKOFF);
+    if(backoff_policy > BACKOFF_ADAPTIVE) backoff_policy = BACKOFF_ADAPTIVE;
+}
+
+
+/*
+ This function spins for n pause instructions, or their equivalent on other architectures.
+ */
+static inline void backoff_spin(unsigned int n){
+    while(n-- != 0) BACKOFF_PAUSE_ONE();
+}
+
+
+/*
+ This function waits before the retry-th pass of a CAS loop, and counts the retry (see stats.h).
+ */
+static inline void backoff_wait(unsigned int retry){
+    unsigned int bound = 1U << (retry < BACKOFF_CAP_SHIFT ? retry : BACKOFF_CAP_SHIFT);
+
+    STATS_ADD(cas_retries, 1);
+
+    switch(backoff_policy){
+    case BACKOFF_PAUSE:
+        BACKOFF_PAUSE_ONE();
+        break;
+    case BACKOFF_EXP:
+        backoff_spin(bound);
+        break;
+    case BACKOFF_RANDOM:
+        // xorshift, seeded with the address of the thread's own state
+        if(backoff_seed == 0) backoff_seed = (unsigned int) (unsigned long long) &backoff_seed | 1;
+        backoff_seed ^= backoff_seed << 13;
+        backoff_seed ^= backoff_seed >> 17;
+        backoff_seed ^= backoff_seed << 5;
+        backoff_spin(backoff_seed & (bound - 1));
+        break;
+    case BACKOFF_ADAPTIVE:
+        backoff_rate += (BACKOFF_RATE_ONE - backoff_rate) >> BACKOFF_RATE_SHIFT;
+        backoff_spin(1 + ((backoff_rate * (unsigned long long) BACKOFF_CAP) >> 16));
+        break;
+    }
+}
+
+#endif
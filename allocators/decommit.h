@@ -0,0 +1,267 @@
+/**
+* This is free software;
+* You can redistribute it and/or modify this file under the
+* terms of the GNU General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+*
+* This file is distributed in the hope that it will be useful, but WITHOUT ANY
+* WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+* A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with
+* this file; if not, write to the Free Software Foundation, Inc.,
+* 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*
+* Copyright (c) 2017 - 2020
+*
+*
+* Romolo Marotta  (Contact author)
+* Mauro Ianni
+* Andrea Scarselli
+*
+*
+* This file implements the decommit policy of the NBBS instances.
+*
+*/
+
+#ifndef __NB_DECOMMIT__
+#define __NB_DECOMMIT__
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+
+/*
+ Pages of the managed memory are given back to the OS in two ways:
+  - eagerly, a block of at least NBBS_DECOMMIT bytes (DECOMMIT at compile time) is decommitted
+    by the thread releasing it, right before it goes back to the tree;
+  - lazily, when NBBS_SCAVENGE is set, a background thread wakes up every NBBS_SCAVENGE ms and
+    decommits the chunks of NBBS_DECOMMIT bytes that have been free for DECOMMIT_IDLE_PASSES
+    passes after the release of a smaller block inside them.
+ The scavenger claims a chunk in the tree before decommitting it, so a concurrent allocation
+ can never see its pages dropped. The claim is a real allocation, and a request can find the
+ chunk taken: the scavenger bumps a sequence word of the instance around each claim, odd while
+ it holds the chunk, and a request that finds no free node checks the word before failing. If
+ the word moved since the request started, it waits for the chunk to go back to the tree and
+ scans again, so a claim never makes a request fail. Successful allocations only pay a load of
+ the word. Releasing a small block only marks its chunk as dirty.
+
+ The including allocator has to add chunk_size, idle and scavenging to struct _nbbs, to provide
+ claim_node and release_node, which take and give back a node of the tree, to check
+ scavenge_raced before failing a request, and to include numa.h first: the scavenger walks the
+ default instances.
+ */
+
+#ifndef DECOMMIT                                // Smallest block decommitted on release
+#define DECOMMIT            0ULL                // Default value: policy disabled
+#endif
+
+#ifndef SCAVENGE                                // Period of the scavenger in ms
+#define SCAVENGE            0ULL                // Default value: no scavenger
+#endif
+
+#define DECOMMIT_DEFAULT    (2ULL << 20)        // chunk size used when only the scavenger is enabled
+#define DECOMMIT_IDLE_PASSES (2U)               // passes a dirty chunk has to stay free before being decommitted
+
+#ifndef MADV_REMOVE
+#define MADV_REMOVE         (9)
+#endif
+
+
+static unsigned long long decommit_size = 0;
+static unsigned long long scavenge_period = 0;
+
+
+/*
+ This function reads the decommit policy. It has to be called before the first instance is built.
+ */
+static void decommit_init(){
+    decommit_size   = getenv_ull("NBBS_DECOMMIT", DECOMMIT);
+    scavenge_period = getenv_ull("NBBS_SCAVENGE", SCAVENGE);
+    if(scavenge_period && !decommit_size) decommit_size = DECOMMIT_DEFAULT;
+}
+
+
+/*
+ This function sets up the decommit state of an instance. With the policy disabled it leaves
+ h->idle to NULL, and releases only pay that check.
+ */
+static void decommit_setup(nbbs *h){
+    unsigned long long chunk = upper_power_of_two(decommit_size);
+    void *idle;
+
+    h->idle       = NULL;
+    h->scavenging = 0;
+    if(decommit_size == 0) return;
+
+    // chunks are nodes of the tree: they cannot be smaller than a page or larger than a block
+    if(chunk < h->min_size) chunk = h->min_size;
+    if(chunk < PAGE_SIZE)   chunk = PAGE_SIZE;
+    if(chunk > h->max_size) chunk = h->max_size;
+    if(chunk < PAGE_SIZE) return;
+
+    idle = mmap(NULL, h->overall_memory_size / chunk, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(idle == MAP_FAILED) return;
+
+    h->chunk_size = chunk;
+    h->idle       = idle;
+}
+
+
+/*
+ This function releases the decommit state of an instance.
+ */
+static void decommit_fini(nbbs *h){
+    if(h->idle != NULL) munmap(h->idle, h->overall_memory_size / h->chunk_size);
+}
+
+
+/*
+ This function gives the pages of a range back to the OS. The range reads as zeroes afterwards.
+ Shared mappings need MADV_REMOVE to drop their pages, private ones MADV_DONTNEED.
+ */
+static inline void decommit(void *addr, unsigned long long len){
+    if(madvise(addr, len, MADV_REMOVE) != 0) madvise(addr, len, MADV_DONTNEED);
+}
+
+
+/*
+ This function applies the policy to a block about to be released. It must be called while the block is still allocated.
+ */
+static inline void decommit_release(nbbs *h, void *ptr, unsigned long long size){
+    unsigned long long c;
+
+    if(h->idle == NULL) return;
+
+    if(size >= h->chunk_size){
+        decommit(ptr, size);
+        return;
+    }
+
+    // read before writing, so that a hot chunk does not bounce among the releasing threads
+    c = ((unsigned long long) ptr - (unsigned long long) h->overall_memory) / h->chunk_size;
+    if(NB_LOAD(&h->idle[c]) != 1) NB_STORE(&h->idle[c], 1);
+}
+
+
+/*
+ This function returns the sequence word of the scavenger on h. A request reads it before scanning the tree.
+ */
+static inline unsigned long long scavenge_seen(nbbs *h){
+    return NB_LOAD_ACQUIRE(&h->scavenging);
+}
+
+
+/*
+ This function tells whether a request that found no free node in h has to scan again, because the
+ scavenger claimed a chunk since the request read seen. It waits for the chunk to go back to the tree,
+ and updates seen for the next scan.
+ The fence pairs with the one in scavenge: a scan that found a claimed node reads the word bumped.
+ */
+static bool scavenge_raced(nbbs *h, unsigned long long *seen){
+    unsigned long long s;
+
+    if(h->idle == NULL || scavenge_period == 0) return false;
+
+    NB_FENCE();
+    while(((s = NB_LOAD_ACQUIRE(&h->scavenging)) & 1ULL) != 0) sched_yield();
+    if(s == *seen) return false;
+
+    *seen = s;
+    return true;
+}
+
+
+/*
+ This function makes a pass of the scavenger on an instance and returns the number of decommitted bytes.
+ Only the scavenger writes h->scavenging.
+ */
+static unsigned long long scavenge(nbbs *h){
+    unsigned long long chunks, first, c, seq, freed = 0;
+    unsigned char idle;
+
+    if(h->idle == NULL) return 0;
+
+    chunks = h->overall_memory_size / h->chunk_size;
+    first  = chunks;                            // index of the node of the first chunk
+
+    for(c = 0; c < chunks; c++){
+        idle = NB_LOAD(&h->idle[c]);
+        if(idle == 0) continue;
+
+        if(idle <= DECOMMIT_IDLE_PASSES){
+            NB_STORE(&h->idle[c], idle+1);
+            continue;
+        }
+
+        // the word is odd while the chunk may be held, and the fence orders it before the claim
+        seq = NB_LOAD(&h->scavenging);
+        NB_STORE(&h->scavenging, seq + 1);
+        NB_FENCE();
+
+        // a chunk still partly allocated is retried after a further idle period
+        if(!claim_node(h, first + c)){
+            NB_STORE_RELEASE(&h->scavenging, seq + 2);
+            NB_STORE(&h->idle[c], 1);
+            continue;
+        }
+
+        NB_STORE(&h->idle[c], 0);
+        decommit((char*) h->overall_memory + c*h->chunk_size, h->chunk_size);
+        release_node(h, first + c);
+        NB_STORE_RELEASE(&h->scavenging, seq + 2);
+        freed += h->chunk_size;
+    }
+
+    return freed;
+}
+
+
+/*
+ Body of the scavenger thread, which walks the default instances forever.
+ */
+static void* scavenger(void *arg){
+    struct timespec period = {scavenge_period / 1000, (scavenge_period % 1000) * 1000000};
+    unsigned int i;
+
+    for(;;){
+        nanosleep(&period, NULL);
+        for(i = 0; i < NB_LOAD_ACQUIRE(&numa_instances); i++) scavenge(numa_slot[i]);
+    }
+    return NULL;
+}
+
+
+/*
+ This function starts the scavenger, if it is enabled. It is called once by init.
+ */
+static void scavenger_start(){
+    pthread_t t;
+
+    if(scavenge_period == 0 || decommit_size == 0) return;
+    if(pthread_create(&t, NULL, scavenger, NULL) == 0) pthread_detach(t);
+    else scavenge_period = 0;
+}
+
+
+/*
+ This function returns how many bytes of a range are backed by physical pages.
+ */
+static unsigned long long decommit_resident(void *addr, unsigned long long len){
+    unsigned char vec[4096];
+    unsigned long long off, step, i, pages = 0;
+
+    for(off = 0; off < len; off += step){
+        step = len - off < sizeof(vec)*PAGE_SIZE ? len - off : sizeof(vec)*PAGE_SIZE;
+        if(mincore((char*) addr + off, step, vec) != 0) return len;
+        for(i = 0; i < (step + PAGE_SIZE - 1) / PAGE_SIZE; i++) pages += vec[i] & 1;
+    }
+
+    return pages * PAGE_SIZE;
+}
+
+#endif
@@ -0,0 +1,118 @@
+/**
+* This is free software;
+* You can redistribute it and/or modify this file under the
+* terms of the GNU General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+*
+* This file is distributed in the hope that it will be useful, but WITHOUT ANY
+* WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+* A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with
+* this file; if not, write to the Free Software Foundation, Inc.,
+* 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*
+* Copyright (c) 2017 - 2020
+*
+*
+* Romolo Marotta  (Contact author)
+* Mauro Ianni
+* Andrea Scarselli
+*
+*
+* This file implements the free-space walk of the NBBS trees.
+*
+*/
+
+#ifndef __NB_FRAG__
+#define __NB_FRAG__
+
+
+/*
+ nbbs_frag reports the free space of an instance by walking its tree from the roots at max_level.
+ The walk reads the occupancy bits as the guided search does (see search.h), and writes nothing:
+  - a free node is a free block, counted at its order, and its subtree is not visited;
+  - a fully occupied node is skipped with its subtree;
+  - a partly occupied node is descended.
+ So the blocks counted are the maximal free ones, the largest a request can get at each address.
+ Allocations and releases go on during the walk, which never waits for them: the result mixes the
+ states of the nodes at the times they were read, and a block taken or released meanwhile may be
+ counted or not.
+
+ The caller chooses the deepest level walked, as the cost of the walk grows with the partly occupied
+ nodes: stopping at level d reads at most 2^d nodes, a few tens of us for d = 14, while the whole of
+ a 20-level tree with every other leaf taken takes about 2ms. Depth 0 walks down to the leaves, and
+ a depth above max_level is raised to it. The free blocks inside the partly occupied nodes of the
+ deepest level are not counted; those nodes are reported as unwalked, and the counts are exact,
+ for a tree at rest, when there is none.
+
+ The external fragmentation index is the share of the free memory that cannot serve a request of
+ max_size bytes, the largest one: 0 when all the free memory is in blocks of max_size, close to 1
+ when it is spread over many small blocks.
+
+ The including allocator has to provide node_state, and to include search.h and stats.h first.
+ */
+
+/*
+ This function sets the external fragmentation index of frag, counted on trees whose largest blocks have max_size bytes.
+ */
+static inline void frag_index(struct nbbs_frag *frag, unsigned long long max_size){
+    double usable = (double) frag->free_blocks[STATS_ORDER(max_size)] * (double) max_size;
+
+    frag->fragmentation = frag->free_bytes != 0 ? 1.0 - usable / (double) frag->free_bytes : 0.0;
+}
+
+
+/*
+ This function walks the tree of h down to level depth and adds its free blocks to frag. largest[i], for i below count, is set
+ to the order of the largest free block below the i-th node at max_level, NBBS_FRAG_FULL if there is none.
+ It returns the number of nodes at max_level.
+ */
+static unsigned long long frag_walk(nbbs *h, struct nbbs_frag *frag, unsigned long long depth, unsigned char *largest, unsigned long long count){
+    unsigned long long roots = 1ULL << (h->max_level - 1), deepest = h->overall_height, r, cur, lvl, size, best;
+
+    if(depth != 0 && deepest > depth) deepest = depth;
+    if(deepest < h->max_level)        deepest = h->max_level;
+
+    for(r = roots; r < 2*roots; r++){
+        // level of the largest free block below r, 0 if none
+        best = 0;
+        cur  = r;
+        lvl  = h->max_level;
+
+        for(;;){
+            switch(node_state(h, cur, lvl)){
+            case NODE_FREE:
+                size = h->overall_memory_size >> (lvl - 1);
+                frag->free_blocks[STATS_ORDER(size)]++;
+                frag->free_bytes += size;
+                if(size > frag->largest)    frag->largest = size;
+                if(best == 0 || lvl < best) best = lvl;
+                break;
+            case NODE_PARTIAL:
+                if(lvl < deepest){
+                    cur = lchild_idx_by_idx(cur);
+                    lvl++;
+                    continue;
+                }
+                frag->unwalked++;
+                break;
+            }
+
+            // the subtree of cur is done: move to the next one on the right, up to r
+            while(lvl > h->max_level && !is_left_by_idx(cur)){
+                cur = parent_idx_by_idx(cur);
+                lvl--;
+            }
+            if(lvl == h->max_level) break;
+            cur++;
+        }
+
+        if(r - roots < count)
+            largest[r - roots] = best != 0 ? STATS_ORDER(h->overall_memory_size >> (best - 1)) : NBBS_FRAG_FULL;
+    }
+    return roots;
+}
+
+#endif
@@ -0,0 +1,212 @@
+/**
+* This is free software;
+* You can redistribute it and/or modify this file under the
+* terms of the GNU General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+*
+* This file is distributed in the hope that it will be useful, but WITHOUT ANY
+* WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+* A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with
+* this file; if not, write to the Free Software Foundation, Inc.,
+* 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*
+* Copyright (c) 2017 - 2020
+*
+*
+* Romolo Marotta  (Contact author)
+* Mauro Ianni
+* Andrea Scarselli
+*
+*
+* This file implements the huge page backing of the NBBS regions.
+*
+*/
+
+#ifndef __NB_HUGEPAGE__
+#define __NB_HUGEPAGE__
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+
+/*
+ The managed memory and the metadata of an instance are mapped through hugepage_map, which
+ honours the mode chosen with NBBS_HUGEPAGES (HUGEPAGES at compile time):
+  0  regular pages, shared anonymous mappings as before;
+  1  transparent huge pages: private anonymous mappings aligned to 2MB and advised with
+     MADV_HUGEPAGE, the kernel backs them with huge pages when it can;
+  2  explicit huge pages from the hugetlbfs pool (MAP_HUGETLB); when the pool cannot
+     satisfy a region, that region falls back to mode 1.
+ Regions smaller than a huge page always use regular pages. In modes 1 and 2 the length
+ of the larger regions is rounded up to a multiple of the huge page size, so they must be
+ released through hugepage_unmap.
+ hugepage_map_aligned also makes the region start on a multiple of a given power of two, so
+ that the blocks of an instance, aligned to their size within the managed memory, are aligned
+ to their size in the address space as well.
+ Building with BD_PRIVATE maps the regular pages private too, so that a forked child gets a copy
+ of the instances instead of sharing them with its parent, as a malloc has to.
+ */
+
+#ifndef HUGEPAGES                               // Huge page mode of the instances
+#define HUGEPAGES           0ULL                // Default value: regular pages
+#endif
+
+#define HUGEPAGE_SIZE       (2ULL << 20)
+#define HUGEPAGE_OFF        (0ULL)
+#define HUGEPAGE_THP        (1ULL)
+#define HUGEPAGE_HUGETLB    (2ULL)
+#define HUGEPAGE_REGIONS    (256U)              // regions remembered for the report at init
+
+#ifdef BD_PRIVATE
+#define HUGEPAGE_REGULAR    (MAP_PRIVATE | MAP_ANONYMOUS)
+#else
+#define HUGEPAGE_REGULAR    (MAP_SHARED | MAP_ANONYMOUS)
+#endif
+
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB         (0x40000)
+#endif
+
+
+typedef struct _hugepage_region{
+    void *addr;
+    unsigned long long len;
+    unsigned long long kind;                    // HUGEPAGE_OFF, HUGEPAGE_THP or HUGEPAGE_HUGETLB
+} hugepage_region;
+
+static unsigned long long hugepage_mode = HUGEPAGE_OFF;
+static hugepage_region hugepage_regions[HUGEPAGE_REGIONS];
+static unsigned int hugepage_count = 0;
+
+
+/*
+ This function reads the huge page mode. It has to be called before the first mapping.
+ */
+static void hugepage_init(){
+    hugepage_mode = getenv_ull("NBBS_HUGEPAGES", HUGEPAGES);
+    if(hugepage_mode > HUGEPAGE_HUGETLB) hugepage_mode = HUGEPAGE_HUGETLB;
+}
+
+
+/*
+ This function returns the length actually mapped for a region of len bytes.
+ */
+static inline unsigned long long hugepage_len(unsigned long long len){
+    if(hugepage_mode == HUGEPAGE_OFF || len < HUGEPAGE_SIZE) return len;
+    return (len + HUGEPAGE_SIZE - 1) & ~(HUGEPAGE_SIZE - 1);
+}
+
+
+/*
+ This function maps len bytes with the given flags at a multiple of align, a power of two:
+ when the kernel does not place the region on such an address, it maps align bytes more and
+ trims the excess on both sides. It returns MAP_FAILED if memory cannot be obtained.
+ */
+static void* hugepage_mmap_aligned(unsigned long long len, unsigned long long align, int flags){
+    char *p, *a;
+
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if(p == MAP_FAILED || ((unsigned long long) p & (align - 1)) == 0) return p;
+    munmap(p, len);
+
+    p = mmap(NULL, len + align, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if(p == MAP_FAILED) return MAP_FAILED;
+
+    a = (char*) (((unsigned long long) p + align - 1) & ~(align - 1));
+    if(a != p) munmap(p, a - p);
+    munmap(a + len, p + align - a);
+    return a;
+}
+
+
+/*
+ This function maps a zeroed region of len bytes starting at a multiple of align, a power of two.
+ It returns MAP_FAILED if memory cannot be obtained.
+ */
+static void* hugepage_map_aligned(unsigned long long len, unsigned long long align){
+    unsigned long long size = hugepage_len(len), kind = HUGEPAGE_OFF;
+    char *p = MAP_FAILED;
+
+    if(hugepage_mode != HUGEPAGE_OFF && len >= HUGEPAGE_SIZE){
+        // huge pages have to start on a huge page boundary
+        if(align < HUGEPAGE_SIZE) align = HUGEPAGE_SIZE;
+
+        if(hugepage_mode == HUGEPAGE_HUGETLB){
+            p = hugepage_mmap_aligned(size, align, MAP_SHARED | MAP_ANONYMOUS | MAP_HUGETLB);
+            kind = HUGEPAGE_HUGETLB;
+        }
+
+        if(p == MAP_FAILED){
+            p = hugepage_mmap_aligned(size, align, MAP_PRIVATE | MAP_ANONYMOUS);
+            if(p == MAP_FAILED) return MAP_FAILED;
+
+            kind = madvise(p, size, MADV_HUGEPAGE) == 0 ? HUGEPAGE_THP : HUGEPAGE_OFF;
+        }
+    }
+    else
+        p = hugepage_mmap_aligned(size, align, HUGEPAGE_REGULAR);
+
+    if(p != MAP_FAILED && hugepage_count < HUGEPAGE_REGIONS)
+        hugepage_regions[hugepage_count++] = (hugepage_region) {p, size, kind};
+    return p;
+}
+
+
+/*
+ This function maps a zeroed region of len bytes. It returns MAP_FAILED if memory cannot be obtained.
+ */
+static void* hugepage_map(unsigned long long len){
+    return hugepage_map_aligned(len, PAGE_SIZE);
+}
+
+
+/*
+ This function releases a region obtained from hugepage_map or hugepage_map_aligned.
+ */
+static void hugepage_unmap(void *addr, unsigned long long len){
+    munmap(addr, hugepage_len(len));
+}
+
+
+/*
+ This function prints how much of the regions mapped so far can use huge pages, and how much of them
+ is currently backed by huge pages according to /proc/self/smaps.
+ */
+static void hugepage_report(){
+    unsigned long long bytes[HUGEPAGE_HUGETLB+1] = {0}, total = 0, resident = 0, start, end, kb;
+    unsigned int i;
+    bool inside = false;
+    char line[256], field[64];
+    FILE *f;
+
+    if(hugepage_mode == HUGEPAGE_OFF) return;
+
+    for(i = 0; i < hugepage_count; i++){
+        bytes[hugepage_regions[i].kind] += hugepage_regions[i].len;
+        total += hugepage_regions[i].len;
+    }
+
+    // a mapping line opens a new region; the size lines that follow belong to it
+    if((f = fopen("/proc/self/smaps", "r")) != NULL){
+        while(fgets(line, sizeof(line), f)){
+            if(sscanf(line, "%llx-%llx", &start, &end) == 2){
+                for(i = 0, inside = false; i < hugepage_count && !inside; i++)
+                    inside = start >= (unsigned long long) hugepage_regions[i].addr && start < (unsigned long long) hugepage_regions[i].addr + hugepage_regions[i].len;
+            }
+            else if(inside && sscanf(line, "%63s %llu", field, &kb) == 2
+                && (!strcmp(field, "AnonHugePages:") || !strcmp(field, "ShmemPmdMapped:") || !strcmp(field, "Shared_Hugetlb:") || !strcmp(field, "Private_Hugetlb:")))
+                resident += kb << 10;
+        }
+        fclose(f);
+    }
+
+    printf("\t Huge pages (%s mode) = %.0f%% hugetlb, %.0f%% THP, %.0f%% regular pages\n", hugepage_mode == HUGEPAGE_HUGETLB ? "hugetlb" : "THP",
+        100.0*bytes[HUGEPAGE_HUGETLB]/total, 100.0*bytes[HUGEPAGE_THP]/total, 100.0*bytes[HUGEPAGE_OFF]/total);
+    printf("\t Huge pages in use = %.0fMB out of %.0fMB mapped\n", resident/1048576.0, total/1048576.0);
+}
+
+#endif
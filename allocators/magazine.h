@@ -0,0 +1,218 @@
+/**
+* This is free software;
+* You can redistribute it and/or modify this file under the
+* terms of the GNU General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+*
+* This file is distributed in the hope that it will be useful, but WITHOUT ANY
+* WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+* A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with
+* this file; if not, write to the Free Software Foundation, Inc.,
+* 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*
+* Copyright (c) 2017 - 2020
+*
+*
+* Romolo Marotta  (Contact author)
+* Mauro Ianni
+* Andrea Scarselli
+*
+*
+* This file implements the per-thread magazine cache shared by the NBBS allocators.
+*
+*/
+
+#ifndef __NB_MAGAZINE__
+#define __NB_MAGAZINE__
+
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+
+
+/*
+ A magazine keeps, for each order, a bounded stack of blocks already claimed in the tree.
+ bd_xx_malloc pops from it and bd_xx_free pushes on it, so a thread that allocates and
+ releases the same size in a loop never touches the shared tree. An empty magazine is
+ refilled, and a full one is flushed, half at a time through the bulk API. The magazine
+ of a thread is drained back to the tree when the thread exits.
+ A magazine caches the blocks of the first instance its thread used: blocks of other
+ instances, e.g. the remote NUMA ones, bypass it.
+
+ The layer is off by default: it is enabled by setting NBBS_MAGAZINE (MAGAZINE at compile
+ time) to the number of blocks cached per order.
+
+ The including allocator has to define struct _nbbs, block_size and level_by_idx and to
+ provide nbbs_malloc, nbbs_free_sized, nbbs_malloc_bulk and nbbs_free_bulk_sized.
+ */
+
+#ifndef MAGAZINE                                // Blocks cached per order by each thread
+#define MAGAZINE                0ULL            // Default value: off
+#endif
+
+#define MAGAZINE_MAX_ROUNDS     (256ULL)        // upper bound for NBBS_MAGAZINE
+#define MAGAZINE_MAX_BYTES      (1ULL << 20)    // bytes cached per order by each thread
+
+
+typedef struct _magazine{
+    nbbs *h;                        // instance the cached blocks belong to
+    unsigned long long map_size;    // size of the mapping holding this struct
+    unsigned long long levels;      // number of cached orders, starting from h->max_level
+    unsigned int *count;            // count[i] is the number of blocks cached at level h->max_level+i
+    void **rounds;                  // blocks cached at level h->max_level+i start from rounds[i*magazine_rounds]
+} magazine;
+
+
+static unsigned long long magazine_rounds = 0;
+static pthread_key_t magazine_key;
+static __thread magazine *my_magazine = NULL;
+
+
+/*
+ This function returns the number of blocks cached for the given level, 0 if the level is not cached.
+ */
+static inline unsigned long long magazine_capacity(nbbs *h, unsigned long long lvl){
+    unsigned long long cap = MAGAZINE_MAX_BYTES / (h->overall_memory_size >> (lvl-1));
+
+    if(cap > magazine_rounds) cap = magazine_rounds;
+    return cap < 2 ? 0 : cap;
+}
+
+
+/*
+ This function gives back to the tree all the blocks cached by a magazine.
+ */
+static void magazine_flush(magazine *m){
+    unsigned long long i;
+
+    for(i = 0; i < m->levels; i++){
+        nbbs_free_bulk_sized(m->h, m->rounds + i*magazine_rounds, m->count[i], m->h->overall_memory_size >> (m->h->max_level + i - 1));
+        m->count[i] = 0;
+    }
+}
+
+
+/*
+ Destructor of the magazine of a thread, called on thread exit.
+ */
+static void magazine_drain(void *arg){
+    magazine *m = arg;
+
+    magazine_flush(m);
+    if(my_magazine == m) my_magazine = NULL;
+    munmap(m, m->map_size);
+}
+
+
+/*
+ This function returns the magazine of the calling thread, building it on first use.
+ Memory is taken with mmap, so that the layer does not depend on malloc.
+ */
+static magazine* magazine_get(nbbs *h){
+    magazine *m = my_magazine;
+    unsigned long long levels, map_size;
+
+    if(m != NULL) return m;
+
+    levels   = h->overall_height - h->max_level + 1;
+    map_size = sizeof(magazine) + levels*sizeof(unsigned int) + levels*magazine_rounds*sizeof(void*);
+    m = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(m == MAP_FAILED) return NULL;
+
+    // mmap returns zeroed memory, so all the magazines start empty
+    m->h        = h;
+    m->map_size = map_size;
+    m->levels   = levels;
+    m->rounds   = (void**) (m + 1);
+    m->count    = (unsigned int*) (m->rounds + levels*magazine_rounds);
+
+    if(pthread_setspecific(magazine_key, m) != 0){
+        munmap(m, map_size);
+        return NULL;
+    }
+    return my_magazine = m;
+}
+
+
+/*
+ This function enables the magazine layer when NBBS_MAGAZINE is set. It is called once by init.
+ */
+static void magazine_init(){
+    magazine_rounds = getenv_ull("NBBS_MAGAZINE", MAGAZINE);
+    if(magazine_rounds > MAGAZINE_MAX_ROUNDS) magazine_rounds = MAGAZINE_MAX_ROUNDS;
+    if(magazine_rounds < 2) magazine_rounds = 0;
+
+    if(magazine_rounds && pthread_key_create(&magazine_key, magazine_drain) != 0)
+        magazine_rounds = 0;
+}
+
+
+/*
+ Memory allocation through the magazine of the calling thread.
+ */
+static void* magazine_malloc(nbbs *h, size_t byte){
+    unsigned long long size, lvl, cap, i;
+    magazine *m;
+    void *p;
+
+    if(byte > h->max_size) return NULL;
+
+    size = block_size(h, byte);
+    lvl  = level_by_idx(h->overall_memory_size / size);
+
+    cap = magazine_capacity(h, lvl);
+    if(cap == 0 || (m = magazine_get(h)) == NULL || m->h != h){
+        p = nbbs_malloc(h, byte);
+
+        // the blocks cached for the other orders may be what keeps the tree full
+        if(p == NULL && (m = my_magazine) != NULL && m->h == h){
+            magazine_flush(m);
+            p = nbbs_malloc(h, byte);
+        }
+        return p;
+    }
+
+    i = lvl - h->max_level;
+    if(m->count[i] == 0){
+        m->count[i] = nbbs_malloc_bulk(h, size, cap/2, m->rounds + i*magazine_rounds);
+
+        // the tree is full: give back what we are holding and try once more
+        if(m->count[i] == 0){
+            magazine_flush(m);
+            return nbbs_malloc(h, byte);
+        }
+    }
+
+    return m->rounds[i*magazine_rounds + --m->count[i]];
+}
+
+
+/*
+ Memory release through the magazine of the calling thread. lvl is the level of the allocated node.
+ */
+static void magazine_free(nbbs *h, void *ptr, unsigned long long lvl){
+    unsigned long long cap = magazine_capacity(h, lvl), size = h->overall_memory_size >> (lvl-1), i;
+    magazine *m;
+    void **r;
+
+    if(cap == 0 || (m = magazine_get(h)) == NULL || m->h != h){
+        nbbs_free_sized(h, ptr, size);
+        return;
+    }
+
+    i = lvl - h->max_level;
+    r = m->rounds + i*magazine_rounds;
+
+    // the magazine is full: flush the oldest half of it
+    if(m->count[i] == cap){
+        nbbs_free_bulk_sized(h, r, cap/2, size);
+        memmove(r, r + cap/2, (cap - cap/2)*sizeof(void*));
+        m->count[i] -= cap/2;
+    }
+    r[m->count[i]++] = ptr;
+}
+
+#endif
@@ -22,22 +22,78 @@ ifdef NUM_LEVELS
 FLAGS :=$(FLAGS) -DNUM_LEVELS=$(NUM_LEVELS)ULL
 endif
 
+ifdef PADDED_LEVELS
+FLAGS :=$(FLAGS) -DPADDED_LEVELS=$(PADDED_LEVELS)ULL
+endif
+
+ifdef NO_FREE_TREE
+FLAGS :=$(FLAGS) -DBD_NO_FREE_TREE
+endif
+
+ifdef HUGEPAGES
+FLAGS :=$(FLAGS) -DHUGEPAGES=$(HUGEPAGES)ULL
+endif
+
+ifdef DECOMMIT
+FLAGS :=$(FLAGS) -DDECOMMIT=$(DECOMMIT)ULL
+endif
+
+ifdef SCAVENGE
+FLAGS :=$(FLAGS) -DSCAVENGE=$(SCAVENGE)ULL
+endif
+
+ifdef SEARCH
+FLAGS :=$(FLAGS) -DSEARCH=$(SEARCH)ULL
+endif
+
+ifdef BACKOFF
+FLAGS :=$(FLAGS) -DBACKOFF=$(BACKOFF)ULL
+endif
+
+ifdef MAGAZINE
+FLAGS :=$(FLAGS) -DMAGAZINE=$(MAGAZINE)ULL
+endif
+
+ifdef SLAB
+FLAGS :=$(FLAGS) -DSLAB=$(SLAB)ULL
+endif
+
+ifdef ARENAS
+FLAGS :=$(FLAGS) -DARENAS=$(ARENAS)ULL
+endif
+
+ifdef STATS
+FLAGS :=$(FLAGS) -DSTATS=$(STATS)ULL
+endif
+
+ifdef TSAN
+FLAGS :=$(FLAGS) -fsanitize=thread
+endif
+
 TARGET = $(notdir $(shell pwd))
 
 OBJS := nballoc.o
 
--include $(OBJS:.o=.d)
+# allocators that can back the malloc family, see ../nbbs-malloc.c; the slab layer is on unless SLAB is given
+# free() does not know the size of the block, so the library is not built without the free_tree
+SHIM_ALLOCATORS = 1lvl-nb 1lvl-sl 4lvl-nb 4lvl-sl
+SHIM := $(if $(NO_FREE_TREE),,$(if $(filter $(TARGET),$(SHIM_ALLOCATORS)),libnbbs-malloc.so))
 
-all: $(OBJS)
+all: $(OBJS) $(SHIM)
+
+-include $(OBJS:.o=.d)
 
 %.o: %.c
 	$(CC) $(CFLAGS) $(FLAGS) $*.c -o $*.o
 	ld -r $*.o ../../utils/utils.o -o nballoc-$(TARGET).o
 	ar rcs lib$(TARGET).a nballoc-$(TARGET).o
 
+libnbbs-malloc.so: nballoc.c ../nbbs-malloc.c $(wildcard ../*.h ../1lvl-nb/*.[ch] ../4lvl-nb/*.[ch] *.h) ../../utils/utils.c
+	$(CC) -shared -fPIC -fvisibility=hidden -ftls-model=initial-exec -O3 -g -Wall -I../../utils -DBD_QUIET -DBD_PRIVATE $(if $(SLAB),,-DSLAB=1ULL) $(FLAGS) nballoc.c ../nbbs-malloc.c ../../utils/utils.c -o $@ -lpthread
+
 
 	
 clean:
-	rm *.o *.d *.a
+	rm *.o *.d *.a $(wildcard *.so)
 
 .PHONY: clean
@@ -0,0 +1,259 @@
+/**
+* This is free software;
+* You can redistribute it and/or modify this file under the
+* terms of the GNU General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+*
+* This file is distributed in the hope that it will be useful, but WITHOUT ANY
+* WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+* A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with
+* this file; if not, write to the Free Software Foundation, Inc.,
+* 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*
+* Copyright (c) 2017 - 2020
+*
+*
+* Romolo Marotta  (Contact author)
+* Mauro Ianni
+* Andrea Scarselli
+*
+*
+* This file implements libnbbs-malloc.so, a replacement of the malloc family on top of the
+* default NBBS instances, to be loaded with LD_PRELOAD.
+*
+*/
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include "atomics.h"
+
+#ifdef BD_NO_FREE_TREE
+#error "free() needs the size of the block: libnbbs-malloc.so cannot be built without the free_tree"
+#endif
+
+
+/*
+ The library is linked with one of the allocators, built with its slab layer on, whose default instances
+ serve two kinds of blocks:
+  - a request the tree can serve gets a block of the tree, or an object of a slab if it is small enough
+    (see ../slab.h). Both are aligned to their size, and at least to SHIM_MIN_ALIGN;
+  - a request the tree cannot serve, because it is larger than the largest block or the tree is full,
+    is mapped on its own, with a header in the page right before the returned address.
+ A release tells the two apart by asking the allocator whether the address is in its managed memory.
+
+ The trees are built by a constructor of the allocator, which calls malloc itself, e.g. from stdio.
+ Until the constructor of this file, which runs right after it, marks the library ready, every request
+ is mapped on its own: mmap never calls back into malloc, so the bootstrap cannot recurse.
+ The library is built with BD_QUIET, since the banner of the allocator would go to the output of the
+ host program, and with BD_PRIVATE, so that a forked child does not share the instances with its parent.
+ */
+
+#define SHIM_EXPORT         __attribute__((visibility("default")))
+
+#define SHIM_PAGE           (4096ULL)
+#define SHIM_MIN_ALIGN      (16ULL)             // alignment of malloc
+
+#define SHIM_TREE           (0)
+#define SHIM_MAPPED         (1)
+
+// API of the allocator linked in, see <allocator>/nballoc.h
+void*  bd_xx_aligned_alloc(size_t align, size_t bytes);
+void*  bd_xx_realloc(void* n, size_t bytes);
+void   bd_xx_free(void* n);
+size_t bd_xx_usable_size(void* n);
+
+
+typedef struct _shim_mapped{
+    void *base;                             // start of the mapping
+    size_t map_size;                        // size of the mapping
+} shim_mapped;
+
+
+static volatile unsigned long long shim_ready = 0;
+
+
+/*
+ This function maps a region for a request the tree cannot serve. align is a power of two.
+ */
+static void* mapped_alloc(size_t align, size_t byte){
+    size_t map_size;
+    char *base, *p;
+    shim_mapped *hdr;
+
+    if(byte > (SIZE_MAX >> 2)) return NULL;
+    if(align < SHIM_PAGE) align = SHIM_PAGE;
+
+    // the header page comes before p, and p is aligned within the first align bytes after it
+    map_size = ((byte + SHIM_PAGE - 1) & ~(SHIM_PAGE - 1)) + align;
+    base = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(base == MAP_FAILED) return NULL;
+
+    p   = (char*) (((uintptr_t) base + SHIM_PAGE + align - 1) & ~(uintptr_t) (align - 1));
+    hdr = (shim_mapped*) (p - SHIM_PAGE);
+    hdr->base     = base;
+    hdr->map_size = map_size;
+    return p;
+}
+
+
+static inline shim_mapped* mapped_header(void *p){
+    return (shim_mapped*) ((char*) p - SHIM_PAGE);
+}
+
+
+static inline size_t mapped_size(void *p){
+    shim_mapped *hdr = mapped_header(p);
+
+    return (char*) hdr->base + hdr->map_size - (char*) p;
+}
+
+
+/*
+ This function tells which kind of block the address p is.
+ */
+static inline int shim_kind(void *p){
+    return bd_xx_usable_size(p) != 0 ? SHIM_TREE : SHIM_MAPPED;
+}
+
+
+/*
+ This function returns the bytes usable in the block at address p.
+ */
+static size_t usable_size(void *p){
+    size_t size = bd_xx_usable_size(p);
+
+    return size != 0 ? size : mapped_size(p);
+}
+
+
+/*
+ This function serves a request of byte bytes aligned to align, a power of two of at least SHIM_MIN_ALIGN.
+ */
+static void* shim_alloc(size_t align, size_t byte){
+    void *p = NULL;
+
+    if(NB_LOAD_ACQUIRE(&shim_ready)) p = bd_xx_aligned_alloc(align, byte);
+    if(p == NULL) p = mapped_alloc(align, byte);
+
+    if(p == NULL) errno = ENOMEM;
+    return p;
+}
+
+
+/*******************************************************************
+ *               MALLOC FAMILY
+ ******************************************************************/
+
+SHIM_EXPORT void* malloc(size_t byte){
+    return shim_alloc(SHIM_MIN_ALIGN, byte);
+}
+
+SHIM_EXPORT void free(void *p){
+    if(p == NULL) return;
+    if(shim_kind(p) == SHIM_TREE)   bd_xx_free(p);
+    else                            munmap(mapped_header(p)->base, mapped_header(p)->map_size);
+}
+
+SHIM_EXPORT void* calloc(size_t count, size_t size){
+    size_t byte;
+    void *p;
+
+    if(__builtin_mul_overflow(count, size, &byte)){
+        errno = ENOMEM;
+        return NULL;
+    }
+    p = shim_alloc(SHIM_MIN_ALIGN, byte);
+
+    // a fresh mapping is already zeroed
+    if(p != NULL && shim_kind(p) != SHIM_MAPPED) memset(p, 0, byte);
+    return p;
+}
+
+SHIM_EXPORT void* realloc(void *p, size_t byte){
+    size_t old;
+    void *q;
+
+    if(p == NULL) return malloc(byte);
+    if(byte == 0){
+        free(p);
+        return NULL;
+    }
+
+    if(shim_kind(p) == SHIM_TREE){
+        // in place when the class of the object or the buddies of the block allow it
+        q = bd_xx_realloc(p, byte < SHIM_MIN_ALIGN ? SHIM_MIN_ALIGN : byte);
+        if(q != NULL) return q;
+        old = bd_xx_usable_size(p);
+    }
+    else{
+        old = mapped_size(p);
+        if(byte <= old) return p;
+    }
+
+    q = malloc(byte);
+    if(q != NULL){
+        memcpy(q, p, old < byte ? old : byte);
+        free(p);
+    }
+    return q;
+}
+
+SHIM_EXPORT void* reallocarray(void *p, size_t count, size_t size){
+    size_t byte;
+
+    if(__builtin_mul_overflow(count, size, &byte)){
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(p, byte);
+}
+
+SHIM_EXPORT void* memalign(size_t align, size_t byte){
+    if(align == 0 || (align & (align - 1)) != 0){
+        errno = EINVAL;
+        return NULL;
+    }
+    return shim_alloc(align < SHIM_MIN_ALIGN ? SHIM_MIN_ALIGN : align, byte);
+}
+
+SHIM_EXPORT void* aligned_alloc(size_t align, size_t byte){
+    return memalign(align, byte);
+}
+
+SHIM_EXPORT int posix_memalign(void **out, size_t align, size_t byte){
+    void *p;
+
+    if(align < sizeof(void*) || (align & (align - 1)) != 0) return EINVAL;
+    p = shim_alloc(align < SHIM_MIN_ALIGN ? SHIM_MIN_ALIGN : align, byte);
+    if(p == NULL) return ENOMEM;
+    *out = p;
+    return 0;
+}
+
+SHIM_EXPORT void* valloc(size_t byte){
+    return shim_alloc(SHIM_PAGE, byte);
+}
+
+SHIM_EXPORT void* pvalloc(size_t byte){
+    return shim_alloc(SHIM_PAGE, (byte + SHIM_PAGE - 1) & ~(SHIM_PAGE - 1));
+}
+
+SHIM_EXPORT size_t malloc_usable_size(void *p){
+    return p == NULL ? 0 : usable_size(p);
+}
+
+
+/*
+ The constructors of the allocator have priority 500: this one runs once the trees are built.
+ */
+__attribute__((constructor(501))) static void shim_init(){
+    NB_STORE_RELEASE(&shim_ready, 1);
+}
@@ -0,0 +1,306 @@
+/**
+* This is free software;
+* You can redistribute it and/or modify this file under the
+* terms of the GNU General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+*
+* This file is distributed in the hope that it will be useful, but WITHOUT ANY
+* WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+* A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with
+* this file; if not, write to the Free Software Foundation, Inc.,
+* 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*
+* Copyright (c) 2017 - 2020
+*
+*
+* Romolo Marotta  (Contact author)
+* Mauro Ianni
+* Andrea Scarselli
+*
+*
+* This file implements the NUMA routing of the default NBBS instances.
+*
+*/
+
+#ifndef __NB_NUMA__
+#define __NB_NUMA__
+
+#include <sched.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+
+/*
+ The default heap is made of one instance per NUMA node. The memory and the metadata of
+ each instance are bound to its node with mbind before they are first touched, so that
+ the CAS traffic on a tree stays within a socket. Allocations are served by the instance
+ of the node the calling thread runs on and fall back to the other nodes, nearest first,
+ when it is exhausted. Releases are routed by address range.
+
+ The number of instances is the number of nodes found in sysfs, and can be lowered
+ (or raised, for testing on UMA machines) through NBBS_NUMA_NODES. With a single node
+ the layer costs a branch per call.
+
+ The routing covers the numa_instances instances of numa_slot: the nodes first, then the arenas
+ the heap may grow by (see arena.h). An arena is not in numa_heap: the thread growing the heap
+ builds it in a private descriptor, which is installed in its slot with a CAS.
+
+ Releases find their instance through a range table. All the instances have the same size, a power
+ of two, so the address space is cut in windows of that size and an instance overlaps at most two of
+ them. The table is a small open addressing hash from the windows to the slots overlapping them:
+ entries are only added, with a CAS, so a lookup is a few loads and never waits. Addresses that no
+ instance owns are reported as such.
+
+ The including allocator has to define struct _nbbs, to provide nbbs_init, nbbs_free_bulk
+ and nbbs_free_bulk_sized, and to include hugepage.h first.
+ */
+
+#define NUMA_MAX_NODES          (64U)           // upper bound for the number of instances
+#define NUMA_SYSFS              "/sys/devices/system/node"
+#define NUMA_TABLE_SIZE         (4*NUMA_MAX_NODES)  // entries of the range table, at most half of them used
+#define NUMA_TABLE_SLOT         (0xFFULL)       // in a table entry: the slot plus one, the window is above
+
+#ifndef MPOL_BIND
+#define MPOL_BIND               (2)
+#endif
+
+
+typedef struct _numa_arena{
+    nbbs h;                                                     // first, so that the handle of an arena is its descriptor
+    unsigned int index;                                         // position of the arena in numa_slot
+} numa_arena;
+
+
+static nbbs numa_heap[NUMA_MAX_NODES];                          // numa_heap[i] is bound to node i
+static nbbs *numa_slot[NUMA_MAX_NODES];                         // numa_slot[i] is the i-th instance, nodes and arenas
+static unsigned int numa_nodes = 1;                             // number of node instances
+static unsigned int numa_instances = 1;                         // number of valid instances, arenas included
+static unsigned char numa_order[NUMA_MAX_NODES][NUMA_MAX_NODES];// numa_order[i] lists the nodes by distance from i
+static bool numa_bound = false;                                 // true if mbind succeeded for every instance
+static unsigned long long numa_table[NUMA_TABLE_SIZE];          // range table, see numa_register
+static unsigned int numa_shift;                                 // log2 of the size of an instance, that is of a window
+
+
+/*
+ This function binds a range of memory to a node. It returns false if the kernel refused it.
+ */
+static bool numa_bind(void *addr, unsigned long long len, int node){
+    unsigned long mask[NUMA_MAX_NODES/(8*sizeof(unsigned long))] = {0};
+
+    if(node < 0) return true;
+    len  = hugepage_len(len);
+    mask[node / (8*sizeof(unsigned long))] = 1UL << (node % (8*sizeof(unsigned long)));
+    return syscall(SYS_mbind, addr, len, MPOL_BIND, mask, NUMA_MAX_NODES+1, 0) == 0;
+}
+
+
+/*
+ This function reads the number of nodes and their distances from sysfs, and
+ builds the fallback order of each node. It returns the number of nodes found.
+ */
+static unsigned int numa_detect(){
+    unsigned int dist[NUMA_MAX_NODES][NUMA_MAX_NODES];
+    unsigned int n, i, j, k, tmp;
+    char path[64];
+    FILE *f;
+
+    for(n = 0; n < NUMA_MAX_NODES; n++){
+        snprintf(path, sizeof(path), NUMA_SYSFS "/node%u/distance", n);
+        if((f = fopen(path, "r")) == NULL) break;
+        for(j = 0; j < NUMA_MAX_NODES && fscanf(f, "%u", &dist[n][j]) == 1; j++);
+        fclose(f);
+    }
+
+    // nodes without a known distance come last, by index
+    for(i = 0; i < NUMA_MAX_NODES; i++)
+        for(j = 0; j < NUMA_MAX_NODES; j++)
+            if(i >= n || j >= n) dist[i][j] = i == j ? 0 : ~0U - NUMA_MAX_NODES + j;
+
+    // insertion sort of each row: the node itself is always the first of its list
+    for(i = 0; i < NUMA_MAX_NODES; i++){
+        numa_order[i][0] = i;
+        for(j = 0, k = 1; j < NUMA_MAX_NODES; j++){
+            if(j == i) continue;
+            for(tmp = k++; tmp > 1 && dist[i][numa_order[i][tmp-1]] > dist[i][j]; tmp--)
+                numa_order[i][tmp] = numa_order[i][tmp-1];
+            numa_order[i][tmp] = j;
+        }
+    }
+
+    return n == 0 ? 1 : n;
+}
+
+
+/*
+ This function returns the first entry of the range table to probe for the window w.
+ */
+static inline unsigned long long numa_hash(unsigned long long w){
+    return ((w * 0x9E3779B97F4A7C15ULL) >> 32) % NUMA_TABLE_SIZE;
+}
+
+
+/*
+ This function adds the windows overlapped by the instance in slot i to the range table.
+ It can be called more than once for the same slot, also concurrently.
+ */
+static void numa_register(unsigned int i){
+    unsigned long long first = (unsigned long long) numa_slot[i]->overall_memory >> numa_shift, w, e, k;
+
+    for(w = first; w <= first + 1; w++){
+        // the second window is overlapped only if the instance is not aligned to its size
+        if(w > first && (unsigned long long) numa_slot[i]->overall_memory == first << numa_shift) break;
+
+        e = (w << 8) | (i + 1);
+        for(k = numa_hash(w); ; k = (k + 1) % NUMA_TABLE_SIZE){
+            if(NB_LOAD_ACQUIRE(&numa_table[k]) == 0 && NB_CAS_RELEASE(&numa_table[k], 0, e)) break;
+            if(NB_LOAD_ACQUIRE(&numa_table[k]) == e) break;
+        }
+    }
+}
+
+
+/*
+ This function builds one instance per node. Nodes whose instance cannot be built are dropped,
+ the instance of node 0 is mandatory. It returns false if not even that one can be built.
+ */
+static bool numa_init(unsigned long long levels, unsigned long long min, unsigned long long max){
+    unsigned int nodes = numa_detect(), i;
+
+    nodes = getenv_ull("NBBS_NUMA_NODES", nodes);
+    if(nodes == 0) nodes = 1;
+    if(nodes > NUMA_MAX_NODES) nodes = NUMA_MAX_NODES;
+
+    // on a single node there is nothing to bind
+    numa_slot[0] = &numa_heap[0];
+    if(nodes == 1){
+        if(!nbbs_init(&numa_heap[0], levels, min, max, -1)) return false;
+        numa_shift = log2_(numa_heap[0].overall_memory_size);
+        numa_register(0);
+        return true;
+    }
+
+    numa_bound = true;
+    for(i = 0; i < nodes; i++){
+        if(!nbbs_init(&numa_heap[i], levels, min, max, i)) break;
+        numa_slot[i] = &numa_heap[i];
+    }
+
+    numa_nodes = numa_instances = i;
+    if(i > 0) numa_shift = log2_(numa_heap[0].overall_memory_size);
+    for(i = 0; i < numa_nodes; i++) numa_register(i);
+#ifndef BD_QUIET
+    if(i < nodes) fprintf(stderr, "NUMA: only %u instances out of %u could be built\n", i, nodes);
+#endif
+
+    // fallback lists must not point to the dropped instances
+    for(i = 0; i < NUMA_MAX_NODES; i++){
+        unsigned int j, k;
+        for(j = 0, k = 0; j < NUMA_MAX_NODES; j++)
+            if(numa_order[i][j] < numa_nodes) numa_order[i][k++] = numa_order[i][j];
+    }
+
+    return numa_nodes > 0;
+}
+
+
+/*
+ This function returns the node of the instance serving the calling thread.
+ */
+static inline unsigned int numa_local(){
+    unsigned int cpu, node;
+
+    if(numa_nodes == 1 || getcpu(&cpu, &node) != 0) return 0;
+    return node < numa_nodes ? node : node % numa_nodes;
+}
+
+
+/*
+ This function returns the i-th instance an allocation from node local tries:
+ the nodes by distance, then the arenas by age.
+ */
+static inline nbbs* numa_instance(unsigned int local, unsigned int i){
+    return i < numa_nodes ? &numa_heap[numa_order[local][i]] : numa_slot[i];
+}
+
+
+/*
+ This function returns the position of the default instance h in numa_slot.
+ */
+static inline unsigned int numa_index(nbbs *h){
+    return h >= numa_heap && h < numa_heap + NUMA_MAX_NODES ? h - numa_heap : ((numa_arena*) h)->index;
+}
+
+
+/*
+ This function tells whether the memory of the instance h contains ptr.
+ */
+static inline bool numa_owns(nbbs *h, void *ptr){
+    return (char*) ptr >= (char*) h->overall_memory && (char*) ptr < (char*) h->overall_memory + h->overall_memory_size;
+}
+
+
+/*
+ This function returns the instance whose memory contains ptr, NULL if no default instance does.
+ */
+static inline nbbs* numa_heap_by_address(void *ptr){
+    unsigned long long w = (unsigned long long) ptr >> numa_shift, e, k;
+
+    if(NB_LOAD(&numa_instances) == 1) return numa_owns(&numa_heap[0], ptr) ? &numa_heap[0] : NULL;
+
+    for(k = numa_hash(w); (e = NB_LOAD(&numa_table[k])) != 0; k = (k + 1) % NUMA_TABLE_SIZE)
+        if(e >> 8 == w && numa_owns(numa_slot[(e & NUMA_TABLE_SLOT) - 1], ptr)) return numa_slot[(e & NUMA_TABLE_SLOT) - 1];
+    return NULL;
+}
+
+
+/*
+ This function tells whether h is one of the default instances.
+ */
+static inline bool numa_is_default(nbbs *h){
+    unsigned int i, n = NB_LOAD_ACQUIRE(&numa_instances);
+
+    for(i = numa_nodes; i < n; i++)
+        if(numa_slot[i] == h) return true;
+    return h >= numa_heap && h < numa_heap + NUMA_MAX_NODES;
+}
+
+
+/*
+ This function releases a batch of blocks through the bulk API of the instances owning them.
+ byte is the size of the blocks, 0 if it is not known. Each chunk of the batch is sorted by instance
+ in a single pass, counting sort, so that every pointer is looked up once. Unknown pointers are skipped.
+ */
+static void numa_free_bulk(void **ptrs, unsigned int count, size_t byte){
+    void *sorted[256];
+    unsigned char slot[256];
+    unsigned int start[NUMA_MAX_NODES+1];
+    unsigned int i, c, k;
+    nbbs *h;
+
+    for(; count > 0; ptrs += k, count -= k){
+        k = count < 256 ? count : 256;
+        memset(start, 0, sizeof(start));
+
+        for(c = 0; c < k; c++){
+            h       = numa_heap_by_address(ptrs[c]);
+            slot[c] = h == NULL ? NUMA_MAX_NODES : numa_index(h);
+            if(h != NULL) start[slot[c] + 1]++;
+        }
+        for(i = 0; i < NUMA_MAX_NODES; i++) start[i + 1] += start[i];
+        for(c = 0; c < k; c++)
+            if(slot[c] < NUMA_MAX_NODES) sorted[start[slot[c]]++] = ptrs[c];
+
+        // each start[i] now points past the blocks of slot i
+        for(i = 0, c = 0; i < NUMA_MAX_NODES; c = start[i++]){
+            if(start[i] == c) continue;
+            if(byte) nbbs_free_bulk_sized(numa_slot[i], sorted + c, start[i] - c, byte);
+            else     nbbs_free_bulk(numa_slot[i], sorted + c, start[i] - c);
+        }
+    }
+}
+
+#endif
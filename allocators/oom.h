@@ -0,0 +1,129 @@
+/**
+* This is free software;
+* You can redistribute it and/or modify this file under the
+* terms of the GNU General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+*
+* This file is distributed in the hope that it will be useful, but WITHOUT ANY
+* WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+* A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with
+* this file; if not, write to the Free Software Foundation, Inc.,
+* 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*
+* Copyright (c) 2017 - 2020
+*
+*
+* Romolo Marotta  (Contact author)
+* Mauro Ianni
+* Andrea Scarselli
+*
+*
+* This file implements the out-of-memory summary of the NBBS instances.
+*
+*/
+
+#ifndef __NB_OOM__
+#define __NB_OOM__
+
+
+/*
+ Each instance keeps a word, h->oom, with the deepest level known to have no free node:
+ since a free node has a free ancestor at every level above it, all the levels above are
+ exhausted too, and a request for any of them fails with a single load instead of a scan.
+
+ The word is set by a request that has just failed its scan, and cleared by every release
+ of a node, including the rollbacks of failed allocations: only releases can make a free
+ node appear. To keep a release racing with the failed scan from being lost, the failing
+ thread arms the word first, then checks the level again with plain reads, and records it
+ only if the generation in the word did not move meanwhile. Releases read the word and
+ write it only when it is armed or set, so they do not share a written line otherwise.
+
+   63-----------------------9--------8-------------------0
+   |       GENERATION        |  ARMED |  EXHAUSTED LEVEL  |
+   |-------------------------|--------|-------------------|
+
+ The including allocator has to add oom to struct _nbbs, to call oom_released after each
+ release of nodes and to include atomics.h and search.h first: the check walks the tree with node_state.
+ */
+
+#define OOM_LEVEL           (0xFFULL)           // deepest exhausted level, 0 if none
+#define OOM_ARMED           (0x100ULL)          // a failed request is checking a level
+#define OOM_GENERATION      (0x200ULL)          // one release while the word was armed or set
+
+
+/*
+ This function tells whether a request at level lvl is bound to fail.
+ */
+static inline bool oom_exhausted(nbbs *h, unsigned long long lvl){
+    return lvl <= (NB_LOAD(&h->oom) & OOM_LEVEL);
+}
+
+
+/*
+ This function has to be called after releasing nodes of an instance.
+ The fence orders the release of the nodes before the read of the word, pairing with the one in oom_record.
+ */
+static inline void oom_released(nbbs *h){
+    unsigned long long w;
+
+    NB_FENCE();
+    while(((w = NB_LOAD(&h->oom)) & (OOM_ARMED | OOM_LEVEL)) != 0)
+        if(NB_CAS_RELAXED(&h->oom, w, (w & ~(OOM_ARMED | OOM_LEVEL)) + OOM_GENERATION)) break;
+}
+
+
+/*
+ This function tells whether some node at level lvl is free, reading the occupancy bits only.
+ Nodes being allocated or released concurrently can be seen either way.
+ */
+static bool oom_level_has_free(nbbs *h, unsigned long long lvl){
+    unsigned long long roots = 1ULL << (h->max_level - 1), cur = roots, cur_lvl = h->max_level;
+    unsigned int state;
+
+    for(;;){
+        state = node_state(h, cur, cur_lvl);
+        if(state == NODE_FREE) return true;
+
+        // a partly occupied node is descended, the others are done with their subtree
+        if(state == NODE_PARTIAL && cur_lvl < lvl){
+            cur = lchild_idx_by_idx(cur);
+            cur_lvl++;
+            continue;
+        }
+
+        while(cur_lvl > h->max_level && !is_left_by_idx(cur)){
+            cur = parent_idx_by_idx(cur);
+            cur_lvl--;
+        }
+        if(++cur == 2*roots) return false;
+    }
+}
+
+
+/*
+ This function records that a request at level lvl has just failed its scan.
+ */
+static void oom_record(nbbs *h, unsigned long long lvl){
+    unsigned long long armed, w;
+
+    if(lvl > OOM_LEVEL) return;
+
+    do{
+        armed = NB_LOAD(&h->oom);
+    }while((armed & OOM_ARMED) == 0 && !NB_CAS_RELAXED(&h->oom, armed, armed | OOM_ARMED));
+
+    // orders the arming before the reads of the tree: a release either sees the word armed or is seen by the check
+    NB_FENCE();
+    if(oom_level_has_free(h, lvl)) return;
+
+    // a release after arming has bumped the generation
+    do{
+        w = NB_LOAD(&h->oom);
+        if((w & ~(OOM_ARMED | OOM_LEVEL)) != (armed & ~(OOM_ARMED | OOM_LEVEL)) || (w & OOM_LEVEL) >= lvl) return;
+    }while(!NB_CAS_RELAXED(&h->oom, w, (w & ~OOM_LEVEL) | lvl));
+}
+
+#endif
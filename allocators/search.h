@@ -0,0 +1,145 @@
+/**
+* This is free software;
+* You can redistribute it and/or modify this file under the
+* terms of the GNU General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+*
+* This file is distributed in the hope that it will be useful, but WITHOUT ANY
+* WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+* A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with
+* this file; if not, write to the Free Software Foundation, Inc.,
+* 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*
+* Copyright (c) 2017 - 2020
+*
+*
+* Romolo Marotta  (Contact author)
+* Mauro Ianni
+* Andrea Scarselli
+*
+*
+* This file implements the guided search for a free node of the NBBS allocators.
+*
+*/
+
+#ifndef __NB_SEARCH__
+#define __NB_SEARCH__
+
+
+/*
+ By default nbbs_malloc sweeps the target level left to right, calling alloc on each candidate
+ and skipping only the subtree of the ancestor that made it fail. With NBBS_SEARCH=1 (SEARCH at
+ compile time) it descends instead from the roots at max_level, reading the occupancy bits:
+  - a free node has nothing allocated below it, so the candidate of its subtree is tried at once;
+  - a fully occupied node is skipped with its whole subtree;
+  - a partly occupied node is descended, into its free child first if it has one.
+ The search starts along the path of the start index (the freemap hint or the slot of the thread),
+ so threads still spread over the level, and then visits the level in the same order as the sweep.
+ A CAS is issued only on candidates whose subtree was free when read: when the bits expose a free
+ subtree the cost is O(levels), and the blocks of a higher order are skipped with one read
+ instead of a failed alloc and its rollback per candidate below them.
+
+ The including allocator has to provide node_state, which classifies a node from its bits, and
+ try_alloc, which behaves like alloc: it returns 0 if it allocated the node, the node that made
+ it fail otherwise.
+ */
+
+#ifndef SEARCH                                  // Search mode of nbbs_malloc
+#define SEARCH              0ULL                // Default value: linear sweep
+#endif
+
+#define SEARCH_SWEEP        (0ULL)
+#define SEARCH_GUIDED       (1ULL)
+
+#define NODE_FREE           (0U)                // nothing allocated in the subtree
+#define NODE_PARTIAL        (1U)                // something allocated below the node
+#define NODE_FULL           (2U)                // the node, or an ancestor of it inside the state word, is allocated
+
+
+static unsigned long long search_mode = SEARCH_SWEEP;
+
+
+/*
+ This function reads the search mode. It is called once by init.
+ */
+static void search_init(){
+    search_mode = getenv_ull("NBBS_SEARCH", SEARCH);
+    if(search_mode > SEARCH_GUIDED) search_mode = SEARCH_GUIDED;
+}
+
+
+/*
+ This function returns the node at level lvl below n (at level n_lvl) with the same offset as start in its subtree.
+ */
+static inline unsigned long long search_candidate(unsigned long long n, unsigned long long n_lvl, unsigned long long start, unsigned long long lvl){
+    return (n << (lvl - n_lvl)) | (start & ((1ULL << (lvl - n_lvl)) - 1));
+}
+
+
+/*
+ This function looks for a free node at level lvl and allocates it. The level is visited in the same circular
+ order as the sweep, from start to the right and then from the first node, but a whole subtree at a time:
+ cur is the root of the next subtree to visit. It returns the index of the allocated node, 0 if none could be allocated.
+ */
+static unsigned long long guided_search(nbbs *h, unsigned long long start, unsigned long long lvl){
+    unsigned long long roots = 1ULL << (h->max_level - 1), cur, cur_lvl, state, failed_at, child;
+    bool wrapped = false;
+
+    // descend from the root above start along its path, down to the first node that is not partly occupied
+    cur_lvl = h->max_level;
+    cur     = start >> (lvl - cur_lvl);
+    while((state = node_state(h, cur, cur_lvl)) == NODE_PARTIAL && cur_lvl < lvl)
+        cur = start >> (lvl - ++cur_lvl);
+
+    for(;;){
+        // back to start after going around the level
+        if(wrapped && (cur << (lvl - cur_lvl)) >= start) return 0;
+
+        if(state == NODE_FREE){
+            child = search_candidate(cur, cur_lvl, start, lvl);
+            if((failed_at = try_alloc(h, child, lvl)) == 0) return child;
+
+            // an ancestor is occupied: its whole subtree is skipped, as the sweep does
+            if(level_by_idx(failed_at) < cur_lvl){
+                cur     = failed_at;
+                cur_lvl = level_by_idx(failed_at);
+            }
+            // the candidate has been taken meanwhile: the rest of the subtree is still worth a visit
+            else if(cur_lvl < lvl)
+                state = NODE_PARTIAL;
+        }
+
+        if(state == NODE_PARTIAL && cur_lvl < lvl){
+            child = lchild_idx_by_idx(cur);
+            state = node_state(h, child, cur_lvl+1);
+
+            // the right child is free while the left one is not: its candidate is taken without descending further
+            if(state != NODE_FREE && node_state(h, child+1, cur_lvl+1) == NODE_FREE
+                && try_alloc(h, search_candidate(child+1, cur_lvl+1, start, lvl), lvl) == 0)
+                return search_candidate(child+1, cur_lvl+1, start, lvl);
+
+            cur = child;
+            cur_lvl++;
+            continue;
+        }
+
+        // the subtree of cur is done: move to the next one on the right, or to the next root
+        while(cur_lvl > h->max_level && !is_left_by_idx(cur)){
+            cur = parent_idx_by_idx(cur);
+            cur_lvl--;
+        }
+        if(cur_lvl > h->max_level)
+            cur++;
+        else if(++cur == 2*roots){
+            if(wrapped) return 0;
+            cur     = roots;
+            wrapped = true;
+        }
+        state = node_state(h, cur, cur_lvl);
+    }
+}
+
+#endif
@@ -0,0 +1,474 @@
+/**
+* This is free software;
+* You can redistribute it and/or modify this file under the
+* terms of the GNU General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+*
+* This file is distributed in the hope that it will be useful, but WITHOUT ANY
+* WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+* A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with
+* this file; if not, write to the Free Software Foundation, Inc.,
+* 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*
+* Copyright (c) 2017 - 2020
+*
+*
+* Romolo Marotta  (Contact author)
+* Mauro Ianni
+* Andrea Scarselli
+*
+*
+* This file implements the slab layer serving objects smaller than the minimum block of the NBBS allocators.
+*
+*/
+
+#ifndef __NB_SLAB__
+#define __NB_SLAB__
+
+#include <pthread.h>
+
+
+/*
+ A request smaller than the minimum block would take a whole leaf of the tree. With NBBS_SLAB=1
+ (SLAB at compile time) bd_xx_malloc serves the requests of 16B to 2KB that fit a class smaller
+ than the minimum block from slabs instead: a slab is a block of SLAB_BYTES of the tree (clamped
+ to the sizes the instance serves), cut in objects of one power of two. Objects sit at multiples
+ of their size from the start of the slab, after its header, so they are aligned to their size
+ as the blocks of the tree are. The leaves of a slab are marked SLAB_ENTRY in the translation
+ table, so that an unsized release finds the slab of an object; a sized release tells an object
+ from a block by its size.
+
+ Each thread owns one active slab per class and takes objects from it without atomics: first
+ from the objects it released itself, then from the slots never used. The other threads release
+ objects on the remote list of the slab, a word updated with a CAS which holds the first object of
+ the list, the length of the list and the state of the slab; the owner takes the whole list when
+ it runs out of objects.
+ A slab the owner leaves, because it is full, because its thread exits or because the thread is
+ now served by another instance, is abandoned: the releases that follow count the objects down.
+ The release leaving the slab half free lists it, per instance and class, for adoption by a thread
+ that needs a slab; the adopting thread takes the remote list and becomes the owner. The release
+ leaving it empty gives the slab back to the tree: if the slab is listed, it takes the whole list of
+ the class instead, gives back all the empty slabs in it and lists the other ones again.
+
+ The layer is off by default, and takes the requests of bd_xx_malloc only: nbbs_malloc keeps
+ serving whole blocks. The including allocator has to include numa.h first.
+ */
+
+#ifndef SLAB                                    // Serve the small requests from slabs
+#define SLAB                0ULL                // Default value: off
+#endif
+
+#define SLAB_BYTES          (64ULL << 10)       // bytes of a slab, if the instance serves such blocks
+#define SLAB_MIN_BYTES      (4096ULL)           // smallest slab
+#define SLAB_HEADER         (128ULL)            // bytes of the header of a slab
+#define SLAB_MIN_SHIFT      (4U)                // smallest object: 16B
+#define SLAB_MAX_SHIFT      (11U)               // largest object: 2KB
+#define SLAB_CLASSES        (SLAB_MAX_SHIFT - SLAB_MIN_SHIFT + 1)
+
+#define SLAB_ENTRY          (0x7FU)             // in the translation table: the leaf is part of a slab
+
+#ifndef BD_NO_FREE_TREE
+#define slab_entry(h, ptr)  ((h)->free_tree[(((unsigned long long)(ptr)) - (unsigned long long)(h)->overall_memory) / (h)->min_size])
+#endif
+
+// remote word of a slab: first object (slot number), length of the list, state and generation
+#define SLAB_HEAD(w)        ((w) & 0xFFFFFFULL)
+#define SLAB_REMOTE(w)      (((w) >> 24) & 0xFFFFFFULL)
+#define SLAB_REMOTE_ONE     (1ULL << 24)
+#define SLAB_ABANDONED      (1ULL << 48)
+#define SLAB_LISTED         (1ULL << 49)
+#define SLAB_GEN_ONE        (1ULL << 50)
+#define SLAB_GEN(w)         ((w) & ~(SLAB_GEN_ONE - 1))
+
+// head of the listed slabs: index of the first slab plus one, and a tag
+#define SLAB_INDEX(w)       ((w) & 0xFFFFFFFFULL)
+#define SLAB_TAG_ONE        (1ULL << 32)
+
+
+typedef struct _slab{
+    // read by the releasing threads
+    unsigned long long remote;                  // remote word
+    nbbs *h;                                    // instance the slab is taken from
+    void *owner;                                // slabs of the owning thread, NULL if abandoned
+    unsigned long long shift;                   // objects are 1 << shift bytes
+    unsigned long long first;                   // first slot holding an object
+    unsigned long long slots;                   // slots of the slab
+    unsigned long long abandoned_taken;         // taken when the slab was abandoned
+    unsigned long long next;                    // index of the next listed slab plus one
+    // used by the owner only, on a cache line of their own
+    unsigned long long bump;                    // first slot never used
+    void *free;                                 // objects released by the owner
+    unsigned long long taken;                   // objects taken and not known to be released
+} slab;
+
+_Static_assert(sizeof(slab) <= SLAB_HEADER, "the header of a slab does not fit SLAB_HEADER");
+
+
+static unsigned long long slab_mode = 0;
+static pthread_key_t slab_key;
+static unsigned long long slab_listed[NUMA_MAX_NODES][SLAB_CLASSES]; // listed slabs, per instance and class
+static __thread slab *my_slabs[SLAB_CLASSES];
+static __thread bool my_slabs_registered = false;
+
+
+/*
+ This function returns the bytes of the slabs of the instance.
+ */
+static inline unsigned long long slab_bytes(nbbs *h){
+    unsigned long long bytes = SLAB_BYTES;
+
+    if(bytes < h->min_size) bytes = h->min_size;
+    if(bytes > h->max_size) bytes = h->max_size;
+    return bytes;
+}
+
+
+/*
+ This function returns the class of a request of at most 2KB.
+ */
+static inline unsigned int slab_class(size_t byte){
+    if(byte <= (1ULL << SLAB_MIN_SHIFT)) return 0;
+    return log2_(byte - 1) + 1 - SLAB_MIN_SHIFT;
+}
+
+
+/*
+ This function tells whether a request of byte bytes is served by a slab of the instance.
+ */
+static inline bool slab_serves(nbbs *h, size_t byte){
+    return slab_mode && byte <= (1ULL << SLAB_MAX_SHIFT) && (1ULL << (slab_class(byte) + SLAB_MIN_SHIFT)) < h->min_size
+        && slab_bytes(h) >= SLAB_MIN_BYTES;
+}
+
+
+/*
+ This function tells whether the address ptr of the instance is an object of a slab, through the translation table.
+ */
+static inline bool slab_object(nbbs *h, void *ptr){
+#ifndef BD_NO_FREE_TREE
+    return slab_mode && slab_entry(h, ptr) == SLAB_ENTRY;
+#else
+    return false;
+#endif
+}
+
+
+static inline slab* slab_of(nbbs *h, void *ptr){
+    return (slab*) ((unsigned long long) ptr & ~(slab_bytes(h) - 1));
+}
+
+
+/*
+ This function returns the size of the object at address ptr.
+ */
+static inline unsigned long long slab_object_size(nbbs *h, void *ptr){
+    return 1ULL << slab_of(h, ptr)->shift;
+}
+
+
+/*
+ This function returns the number of objects still taken below which an abandoned slab is listed.
+ */
+static inline unsigned long long slab_threshold(slab *s){
+    return (s->slots - s->first) / 2;
+}
+
+
+static inline void* slab_slot(slab *s, unsigned long long i){
+    return i ? (char*) s + (i << s->shift) : NULL;
+}
+
+
+/*
+ This function gives a slab back to the tree. The first leaf gets back the level of the block,
+ so that the block is not taken for a slab if a magazine caches it.
+ */
+static void slab_release(slab *s){
+    nbbs *h = s->h;
+    unsigned long long bytes = slab_bytes(h);
+
+#ifndef BD_NO_FREE_TREE
+    slab_entry(h, s) = level_by_idx(h->overall_memory_size / bytes);
+#endif
+    nbbs_free_sized(h, s, bytes);
+}
+
+
+/*
+ The lists link slabs by their index in the instance, plus one so that zero ends a list.
+ */
+static inline unsigned long long slab_index(slab *s){
+    return ((char*) s - (char*) s->h->overall_memory) / slab_bytes(s->h) + 1;
+}
+
+static inline slab* slab_by_index(nbbs *h, unsigned long long i){
+    return i ? (slab*) ((char*) h->overall_memory + (i - 1) * slab_bytes(h)) : NULL;
+}
+
+
+/*
+ These functions push and pop the listed slabs of an instance and class. The high half of the head
+ holds a tag, which changes at each update so that a stale pop fails.
+ */
+static void slab_push(slab *s, unsigned int cls){
+    unsigned long long *head = &slab_listed[numa_index(s->h)][cls], old;
+
+    do{
+        old = NB_LOAD(head);
+        NB_STORE(&s->next, SLAB_INDEX(old));
+    }while(!NB_CAS_RELEASE(head, old, (old & ~SLAB_INDEX(old)) + SLAB_TAG_ONE + slab_index(s)));
+}
+
+static slab* slab_pop(nbbs *h, unsigned int cls){
+    unsigned long long *head = &slab_listed[numa_index(h)][cls], old;
+    slab *s;
+
+    do{
+        old = NB_LOAD_ACQUIRE(head);
+        s   = slab_by_index(h, SLAB_INDEX(old));
+        if(s == NULL) return NULL;
+    }while(!NB_CAS_ACQUIRE(head, old, (old & ~SLAB_INDEX(old)) + SLAB_TAG_ONE + NB_LOAD(&s->next)));
+    return s;
+}
+
+
+/*
+ This function takes all the listed slabs of an instance and class, gives back to the tree the empty
+ ones and lists the other ones again. Taken slabs cannot be adopted, so they can be given back safely.
+ */
+static void slab_sweep(nbbs *h, unsigned int cls){
+    unsigned long long *head = &slab_listed[numa_index(h)][cls], old;
+    slab *s, *next;
+
+    do{
+        old = NB_LOAD_ACQUIRE(head);
+    }while(!NB_CAS_ACQ_REL(head, old, (old & ~SLAB_INDEX(old)) + SLAB_TAG_ONE));
+
+    for(s = slab_by_index(h, SLAB_INDEX(old)); s != NULL; s = next){
+        next = slab_by_index(h, NB_LOAD(&s->next));
+        if(SLAB_REMOTE(NB_LOAD_ACQUIRE(&s->remote)) == NB_LOAD(&s->abandoned_taken))   slab_release(s);
+        else                                                                            slab_push(s, cls);
+    }
+}
+
+
+/*
+ Destructor of the slabs of a thread, called on thread exit: the active slabs are abandoned.
+ */
+static void slab_abandon(slab *s);
+
+static void slab_drain(void *arg){
+    unsigned int cls;
+
+    for(cls = 0; cls < SLAB_CLASSES; cls++){
+        if(my_slabs[cls] != NULL) slab_abandon(my_slabs[cls]);
+        my_slabs[cls] = NULL;
+    }
+    // a later destructor may take slabs again: they are drained in the next round
+    my_slabs_registered = false;
+}
+
+
+/*
+ This function enables the slab layer when NBBS_SLAB is set. It is called once by init.
+ Without the translation table the layer stays off, since an unsized release could not find the slabs.
+ */
+static void slab_init(){
+#ifndef BD_NO_FREE_TREE
+    slab_mode = getenv_ull("NBBS_SLAB", SLAB) != 0;
+#endif
+
+    if(slab_mode && pthread_key_create(&slab_key, slab_drain) != 0)
+        slab_mode = 0;
+}
+
+
+/*
+ This function takes an object from a slab owned by the calling thread, NULL if the slab is full.
+ */
+static inline void* slab_take(slab *s){
+    unsigned long long old;
+    void *obj = s->free;
+
+    if(obj == NULL){
+        if(s->bump < s->slots) obj = slab_slot(s, s->bump++);
+        else{
+            // the remote list becomes the list of the owner
+            do{
+                old = NB_LOAD_ACQUIRE(&s->remote);
+                if(SLAB_HEAD(old) == 0) return NULL;
+            }while(!NB_CAS_ACQUIRE(&s->remote, old, SLAB_GEN(old)));
+            s->taken -= SLAB_REMOTE(old);
+            obj = slab_slot(s, SLAB_HEAD(old));
+            s->free = *(void**) obj;
+        }
+    }
+    else s->free = *(void**) obj;
+
+    s->taken++;
+    return obj;
+}
+
+
+/*
+ This function abandons a slab owned by the calling thread.
+ */
+static void slab_abandon(slab *s){
+    unsigned long long old, new, live;
+
+    NB_STORE(&s->owner, NULL);
+    NB_STORE(&s->abandoned_taken, s->taken);
+
+    do{
+        old  = NB_LOAD_ACQUIRE(&s->remote);
+        live = s->taken - SLAB_REMOTE(old);
+        new  = old | SLAB_ABANDONED;
+        if(live > 0 && live <= slab_threshold(s)) new |= SLAB_LISTED;
+    }while(!NB_CAS_ACQ_REL(&s->remote, old, new));
+
+    // no object is taken: no release can come any more
+    if(live == 0)                   slab_release(s);
+    else if(new & SLAB_LISTED)      slab_push(s, s->shift - SLAB_MIN_SHIFT);
+}
+
+
+/*
+ This function adopts a listed slab of the instance and class, NULL if there is none.
+ */
+static slab* slab_adopt(nbbs *h, unsigned int cls){
+    slab *s = slab_pop(h, cls);
+    unsigned long long old;
+    void *obj;
+
+    if(s == NULL) return NULL;
+
+    do{
+        old = NB_LOAD_ACQUIRE(&s->remote);
+    }while(!NB_CAS_ACQ_REL(&s->remote, old, SLAB_GEN(old) + SLAB_GEN_ONE));
+
+    // the objects released while abandoned join the ones released by the last owner
+    s->taken = s->abandoned_taken - SLAB_REMOTE(old);
+    for(obj = slab_slot(s, SLAB_HEAD(old)); obj != NULL; ){
+        void *next = *(void**) obj;
+
+        *(void**) obj = s->free;
+        s->free = obj;
+        obj = next;
+    }
+    NB_STORE(&s->owner, my_slabs);
+    return s;
+}
+
+
+/*
+ This function takes a new slab of the class from the tree.
+ */
+static slab* slab_new(nbbs *h, unsigned int cls){
+    unsigned long long bytes = slab_bytes(h), i;
+    slab *s = nbbs_malloc(h, bytes);
+
+    if(s == NULL) return NULL;
+
+    s->h      = h;
+    s->shift  = cls + SLAB_MIN_SHIFT;
+    s->slots  = bytes >> s->shift;
+    s->first  = (SLAB_HEADER + (1ULL << s->shift) - 1) >> s->shift;
+    s->bump   = s->first;
+    s->free   = NULL;
+    s->taken  = 0;
+    s->abandoned_taken = 0;
+    NB_STORE(&s->remote, 0);
+
+#ifndef BD_NO_FREE_TREE
+    for(i = 0; i < bytes; i += h->min_size) slab_entry(h, (char*) s + i) = SLAB_ENTRY;
+#else
+    (void) i;
+#endif
+    NB_STORE(&s->owner, my_slabs);
+    return s;
+}
+
+
+/*
+ Memory allocation through the active slab of the calling thread.
+ */
+static void* slab_malloc(nbbs *h, size_t byte){
+    unsigned int cls = slab_class(byte);
+    slab *s = my_slabs[cls];
+    void *obj;
+
+    if(s != NULL && s->h == h && (obj = slab_take(s)) != NULL) return obj;
+
+    if(!my_slabs_registered){
+        my_slabs_registered = true;
+        pthread_setspecific(slab_key, my_slabs);
+    }
+
+    if(s != NULL) slab_abandon(s);
+    my_slabs[cls] = NULL;
+
+    if((s = slab_adopt(h, cls)) == NULL && (s = slab_new(h, cls)) == NULL) return NULL;
+    my_slabs[cls] = s;
+    return slab_take(s);
+}
+
+
+/*
+ Memory release of the object at address ptr.
+ */
+static void slab_free(nbbs *h, void *ptr){
+    slab *s = slab_of(h, ptr);
+    unsigned long long old, new, live = 0;
+
+    if(NB_LOAD(&s->owner) == (void*) my_slabs){
+        *(void**) ptr = s->free;
+        s->free = ptr;
+        s->taken--;
+        return;
+    }
+
+    do{
+        old = NB_LOAD_ACQUIRE(&s->remote);
+        *(void**) ptr = slab_slot(s, SLAB_HEAD(old));
+        new = (old & ~0xFFFFFFULL) + SLAB_REMOTE_ONE + (((char*) ptr - (char*) s) >> s->shift);
+
+        // an abandoned slab is counted down: the release crossing the threshold lists it
+        if(old & SLAB_ABANDONED){
+            live = NB_LOAD(&s->abandoned_taken) - SLAB_REMOTE(new);
+            if(live == slab_threshold(s)) new |= SLAB_LISTED;
+        }
+    }while(!NB_CAS_ACQ_REL(&s->remote, old, new));
+
+    if(!(old & SLAB_ABANDONED)) return;
+    if(live == 0)                                   (new & SLAB_LISTED) ? slab_sweep(h, s->shift - SLAB_MIN_SHIFT) : slab_release(s);
+    else if((new & SLAB_LISTED) && !(old & SLAB_LISTED)) slab_push(s, s->shift - SLAB_MIN_SHIFT);
+}
+
+
+/*
+ Bulk release of blocks of the default instances, some of which can be objects of a slab.
+ If byte is not zero it is the size of all the blocks.
+ */
+static void slab_free_bulk(void **ptrs, unsigned int count, size_t byte){
+    void *batch[256];
+    unsigned int i, k = 0;
+    nbbs *h;
+
+    for(i = 0; i < count; i++){
+        // addresses the heap does not own are skipped
+        if((h = numa_heap_by_address(ptrs[i])) != NULL){
+            if(byte ? slab_serves(h, byte) : slab_object(h, ptrs[i]))  slab_free(h, ptrs[i]);
+            else                                                        batch[k++] = ptrs[i];
+        }
+
+        if(k == 256 || (k > 0 && i == count-1)){
+            numa_free_bulk(batch, k, byte);
+            k = 0;
+        }
+    }
+}
+
+#endif
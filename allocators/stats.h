@@ -0,0 +1,215 @@
+/**
+* This is free software;
+* You can redistribute it and/or modify this file under the
+* terms of the GNU General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+*
+* This file is distributed in the hope that it will be useful, but WITHOUT ANY
+* WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+* A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with
+* this file; if not, write to the Free Software Foundation, Inc.,
+* 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*
+* Copyright (c) 2017 - 2020
+*
+*
+* Romolo Marotta  (Contact author)
+* Mauro Ianni
+* Andrea Scarselli
+*
+*
+* This file implements the statistics of the NBBS trees.
+*
+*/
+
+#ifndef __NB_STATS__
+#define __NB_STATS__
+
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+
+
+/*
+ Every thread counts its own operations on the trees, of every instance, in a block of counters
+ that only it writes: an update is a plain add on a private cache line, with no atomic RMW.
+ The blocks are linked in a registry, which nbbs_stats walks to sum them; the sum is taken
+ while the threads keep running, so it is a snapshot of each counter rather than of the whole.
+ The block of an exited thread stays in the registry with its counts, and is taken over by the
+ next thread that starts, so the registry is as long as the largest number of live threads.
+
+ The counters are kept at the level of the trees: a block cut in slab objects or cached by a
+ magazine is in use, and the bytes of a block are the ones of its node; a block resized in place
+ is counted as released at its old order and taken at its new one. A rollback is a claimed node given back because an ancestor was taken meanwhile, and
+ every failed CAS on the tree is counted where the retry loop waits for it (see backoff.h).
+
+ The counters are on by default: NBBS_STATS=0 (STATS=0 at compile time) turns them off.
+ The including allocator has to define struct nbbs_stats and NBBS_STATS_ORDERS.
+ */
+
+#ifndef STATS                                   // Count the operations on the trees
+#define STATS               1ULL                // Default value: on
+#endif
+
+
+typedef struct _stats_block{
+    unsigned long long allocs[NBBS_STATS_ORDERS];   // blocks taken, by order
+    unsigned long long frees[NBBS_STATS_ORDERS];    // blocks released, by order
+    unsigned long long failures[NBBS_STATS_ORDERS]; // requests not served, by order
+    unsigned long long attempts;                    // nodes tried by the allocations
+    unsigned long long cas_retries;                 // failed CAS on the tree
+    unsigned long long rollbacks;                   // claims undone
+    long long bytes;                                // bytes taken minus bytes released
+    struct _stats_block *next;                      // next block of the registry
+    unsigned long long owned;                       // 1 while a thread writes the block
+} stats_block;
+
+
+static unsigned long long stats_mode = 0;
+static stats_block *stats_list = NULL;
+static pthread_key_t stats_key;
+static __thread stats_block *my_stats = NULL;
+
+
+/*
+ Destructor of the block of a thread, called on thread exit: the block is left to the next thread.
+ */
+static void stats_detach(void *arg){
+    stats_block *s = arg;
+
+    if(my_stats == s) my_stats = NULL;
+    NB_STORE_RELEASE(&s->owned, 0);
+}
+
+
+/*
+ This function gives the calling thread a block of counters: a free one from the registry,
+ or a new one, mapped with mmap so that the layer does not depend on malloc.
+ It returns NULL if the counters are off or no block can be obtained.
+ */
+static stats_block* stats_attach(){
+    stats_block *s, *head;
+
+    if(!stats_mode) return NULL;
+
+    for(s = NB_LOAD_ACQUIRE(&stats_list); s != NULL; s = s->next)
+        if(NB_LOAD(&s->owned) == 0 && NB_CAS_ACQUIRE(&s->owned, 0, 1)) break;
+
+    if(s == NULL){
+        s = mmap(NULL, sizeof(stats_block), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(s == MAP_FAILED) return NULL;
+        s->owned = 1;
+        do{
+            head    = NB_LOAD(&stats_list);
+            s->next = head;
+        }while(!NB_CAS_RELEASE(&stats_list, head, s));
+    }
+
+    // set first: the key may allocate, and come back here
+    my_stats = s;
+    if(pthread_setspecific(stats_key, s) != 0){
+        my_stats = NULL;
+        NB_STORE_RELEASE(&s->owned, 0);
+        return NULL;
+    }
+    return s;
+}
+
+
+/*
+ This function returns the block of the calling thread, NULL if the counters are off.
+ */
+static inline stats_block* stats_mine(){
+    stats_block *s = my_stats;
+
+    return s != NULL ? s : stats_attach();
+}
+
+
+// adds v to a counter of the calling thread; only the owner writes it, the store is atomic for the readers
+#define STATS_ADD(field, v)     do{ \
+                                    stats_block *__s = stats_mine(); \
+                                    if(__s != NULL) NB_STORE(&__s->field, __s->field + (v)); \
+                                }while(0)
+
+// order of a block, the log2 of its size
+#define STATS_ORDER(size)       (__builtin_ctzll(size))
+
+
+/*
+ This function counts count blocks of size bytes taken from a tree.
+ */
+static inline void stats_alloc(unsigned long long size, unsigned long long count){
+    stats_block *s = stats_mine();
+
+    if(s == NULL) return;
+    NB_STORE(&s->allocs[STATS_ORDER(size)], s->allocs[STATS_ORDER(size)] + count);
+    NB_STORE(&s->bytes, s->bytes + (long long) (size*count));
+}
+
+
+/*
+ This function counts a block of size bytes released to a tree.
+ */
+static inline void stats_free(unsigned long long size){
+    stats_block *s = stats_mine();
+
+    if(s == NULL) return;
+    NB_STORE(&s->frees[STATS_ORDER(size)], s->frees[STATS_ORDER(size)] + 1);
+    NB_STORE(&s->bytes, s->bytes - (long long) size);
+}
+
+
+/*
+ This function counts a block of from bytes that now has size to bytes: it is released at its old order
+ and taken at the new one.
+ */
+static inline void stats_resize(unsigned long long from, unsigned long long to){
+    stats_free(from);
+    stats_alloc(to, 1);
+}
+
+
+/*
+ This function counts count requests for blocks of size bytes that a tree could not serve.
+ */
+static inline void stats_failure(unsigned long long size, unsigned long long count){
+    STATS_ADD(failures[STATS_ORDER(size)], count);
+}
+
+
+/*
+ This function enables the counters unless NBBS_STATS=0. It is called once by init.
+ */
+static void stats_init(){
+    stats_mode = getenv_ull("NBBS_STATS", STATS) != 0;
+    if(stats_mode && pthread_key_create(&stats_key, stats_detach) != 0) stats_mode = 0;
+}
+
+
+/*
+ This function sums the counters of all the threads in out.
+ */
+static void stats_merge(struct nbbs_stats *out){
+    stats_block *s;
+    unsigned int i;
+
+    memset(out, 0, sizeof(*out));
+    for(s = NB_LOAD_ACQUIRE(&stats_list); s != NULL; s = s->next){
+        for(i = 0; i < NBBS_STATS_ORDERS; i++){
+            out->allocs[i]   += NB_LOAD(&s->allocs[i]);
+            out->frees[i]    += NB_LOAD(&s->frees[i]);
+            out->failures[i] += NB_LOAD(&s->failures[i]);
+        }
+        out->attempts     += NB_LOAD(&s->attempts);
+        out->cas_retries  += NB_LOAD(&s->cas_retries);
+        out->rollbacks    += NB_LOAD(&s->rollbacks);
+        out->bytes_in_use += NB_LOAD(&s->bytes);
+        out->threads++;
+    }
+}
+
+#endif
@@ -0,0 +1,59 @@
+#include "parameters.h"
+
+void* bd_xx_malloc(size_t);
+void  bd_xx_free(void*);
+
+static volatile unsigned int arrived = 0;
+
+static void barrier(unsigned int number_of_processes, unsigned int round){
+	__sync_fetch_and_add(&arrived, 1);
+	while(__atomic_load_n(&arrived, __ATOMIC_ACQUIRE) < round*number_of_processes);
+}
+
+/*
+ Every thread takes blocks of fixed_size bytes until the heap is exhausted, then releases the blocks
+ at an even position of the heap: half of the memory is free, but no block of twice the size is.
+ The requests for twice the size that follow are all bound to fail, and their latency is measured.
+ */
+void adversarial_fill(unsigned long long fixed_size, unsigned int number_of_processes, unsigned long long *allocs, unsigned long long *failures, unsigned long long *frees, unsigned long long *fail_clocks){
+	unsigned long long i, n = 0;
+	void **chunks = malloc(sizeof(void*)*AF_MAX_BLOCKS);
+	void *obt;
+	clock_timer fail_timer;
+	
+	while(n < AF_MAX_BLOCKS && (chunks[n] = TO_BE_REPLACED_MALLOC(fixed_size)) != NULL)
+		n++;
+	*allocs += n;
+	barrier(number_of_processes, 1);
+	
+	for(i=0;i<n;i++){
+		if((((unsigned long long) chunks[i]) / fixed_size) % 2 == 0){
+			TO_BE_REPLACED_FREE(chunks[i]);
+			chunks[i] = NULL;
+			(*frees)++;
+		}
+	}
+	barrier(number_of_processes, 2);
+	
+	for(i=0;i<AF_REQUESTS;i++){
+		clock_timer_start(fail_timer);
+		obt = TO_BE_REPLACED_MALLOC(2*fixed_size);
+		if(obt == NULL){
+			*fail_clocks += clock_timer_value(fail_timer);
+			(*failures)++;
+			continue;
+		}
+		TO_BE_REPLACED_FREE(obt);
+		(*allocs)++;
+		(*frees)++;
+	}
+	barrier(number_of_processes, 3);
+	
+	for(i=0;i<n;i++){
+		if(chunks[i] != NULL){
+			TO_BE_REPLACED_FREE(chunks[i]);
+			(*frees)++;
+		}
+	}
+	free(chunks);
+}
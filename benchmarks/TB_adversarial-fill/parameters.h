@@ -0,0 +1,7 @@
+#ifndef __AF_PARAMETERS__
+#define __AF_PARAMETERS__
+
+#define AF_MAX_BLOCKS	(1ULL << 20)
+#define AF_REQUESTS		100000ULL
+
+#endif
@@ -38,7 +38,7 @@ void * init_run(){
 	//child code, do work and exit.
 	myid = __sync_fetch_and_add(&pcount, 1);//myid = getpid() % number_of_processes;// 	
 	
-	while(*start==0);
+	while(__atomic_load_n(start, __ATOMIC_ACQUIRE)==0);
 #if KERNEL_BD == 0
 	ops[myid] = CA_ITERATIONS;
 	cached_allocation(fixed_size, allocs+myid, failures+myid, frees+myid);
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <errno.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <time.h>
 #include <pthread.h>
 #include <string.h>
@@ -20,6 +21,7 @@ __thread unsigned int myid=0;
 
 static unsigned long long *volatile failures, *volatile allocs, *volatile frees, *volatile ops;
 static unsigned long long *volatile memory;
+static unsigned long long *volatile fail_clocks;
 unsigned int *start;
 
 unsigned long long fixed_size;
@@ -39,7 +41,7 @@ void * init_run(){
 	//child code, do work and exit.
 	myid = __sync_fetch_and_add(&pcount, 1);//myid = getpid() % number_of_processes;// 	
 	
-	while(*start==0);
+	while(__atomic_load_n(start, __ATOMIC_ACQUIRE)==0);
 #if KERNEL_BD == 0
 	ops[myid] = CO_ITERATIONS / number_of_processes;
 	fixedsize(fixed_size, number_of_processes, allocs+myid, failures+myid, frees+myid);
@@ -60,10 +62,11 @@ __attribute__((constructor(400))) void pre_main2(int argc, char**argv){
 	frees = mmap(NULL, sizeof(unsigned long long) * number_of_processes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
 	ops = mmap(NULL, sizeof(unsigned long long) * number_of_processes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
 	memory = mmap(NULL, sizeof(unsigned long long) * number_of_processes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	fail_clocks = mmap(NULL, sizeof(unsigned long long) * number_of_processes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
 	start = mmap(NULL, sizeof(unsigned int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
 	*start = 0;
 	for(i=0; i<number_of_processes; i++){
-		allocs[i] = frees[i] = failures[i] = ops[i] = memory[i] = 0;
+		allocs[i] = frees[i] = failures[i] = ops[i] = memory[i] = fail_clocks[i] = 0;
 	}
 }
 
@@ -72,8 +75,9 @@ int main(int argc, char**argv){
   printf("USING ALLOCATOR: %s\n", ALLOCATOR_NAME);
 	int status, local_pid, i=0;
 	unsigned long long exec_time;
+	struct rusage usage;
 	unsigned long long total_fail = 0, total_alloc = 0, total_free = 0, total_ops = 0;
-	unsigned long long total_mem = 0;
+	unsigned long long total_mem = 0, total_fail_clocks = 0;
 
 
 	if(argc!=3){
@@ -100,6 +104,8 @@ int main(int argc, char**argv){
 	}
 	
 	printf("Timer  (clocks): %llu\n",clock_timer_value(exec_time));
+	getrusage(RUSAGE_SELF, &usage);
+	printf("Max RSS    (KB): %ld\n", usage.ru_maxrss);
 	
 	   
 		
@@ -112,12 +118,14 @@ int main(int argc, char**argv){
 		printf("\t allocati: %10llu ;", allocs[i]);
 		printf("\t dealloca: %10llu ;", frees[i]);
 		printf("\t failures: %10llu ;", failures[i]);
+		printf("\t clk/fail: %10llu ;", failures[i] ? fail_clocks[i]/failures[i] : 0);
 		printf("\t memory  : %10llu Bytes \n", memory[i]);
 		total_fail += failures[i];
 		total_alloc += allocs[i];
 		total_free += frees[i];
 		total_ops += ops[i];
 		total_mem += memory[i];
+		total_fail_clocks += fail_clocks[i];
 	}
 	printf("_______________________________________\n");
 	printf("Total ops exp     %10llu\n", total_ops);
@@ -128,6 +136,7 @@ int main(int argc, char**argv){
 	printf("        mem:  	  %10llu Bytes\n", total_mem);
 	printf("............................\n");	
 	printf("total failures:   %10llu\n", total_fail);
+	printf("clocks per fail:  %10llu\n", total_fail ? total_fail_clocks/total_fail : 0);
 #ifdef DEBUG
 	printf("total nodes alloc:%10llu\n", *node_allocated);
 	printf("total memo alloc: %10llu Bytes\n", *size_allocated);
@@ -34,6 +34,9 @@ void fixedsize(ALLOC_GET_PAR(unsigned long long fixed_size, unsigned int fixed_o
 	unsigned int *sizes  	   = vmalloc(sizeof(unsigned int)*blocchi);
 	unsigned int max_order = fixed_order + (CO_LEVELS-1);
 	unsigned int scelta;
+#endif
+#if KERNEL_BD == 0
+	clock_timer fail_timer;
 #endif
 	struct my_drand48_data randBuffer;
     my_srand48_r(17*myid, &randBuffer);
@@ -56,10 +59,17 @@ void fixedsize(ALLOC_GET_PAR(unsigned long long fixed_size, unsigned int fixed_o
 		my_lrand48_r(&randBuffer, &r);
 		j = (unsigned int)r;
 		j = j % blocchi;
-		TO_BE_REPLACED_FREE(FREE_GET_PAR(chunks[j], sizes[j]));
+		if (chunks[j] != cmp)
+			TO_BE_REPLACED_FREE(FREE_GET_PAR(chunks[j], sizes[j]));
+#if KERNEL_BD == 0
+		clock_timer_start(fail_timer);
+#endif
 		chunks[j] = TO_BE_REPLACED_MALLOC(sizes[j]);
 		if (chunks[j] == cmp){
 			(*failures)++;
+#if KERNEL_BD == 0
+			fail_clocks[myid] += clock_timer_value(fail_timer);
+#endif
 			continue;
 		}
 		(*allocs)++;
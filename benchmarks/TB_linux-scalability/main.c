@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <errno.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <time.h>
 #include <pthread.h>
 #include <sys/wait.h>
@@ -39,7 +40,7 @@ void * init_run(){
 	//child code, do work and exit.
 	myid = __sync_fetch_and_add(&pcount, 1);//myid = getpid() % number_of_processes;// 	
 	
-	while(*start==0);
+	while(__atomic_load_n(start, __ATOMIC_ACQUIRE)==0);
 #if KERNEL_BD == 0
 	ops[myid] = LS_ITERATIONS;
 	linux_scalability(fixed_size, allocs+myid, failures+myid, frees+myid);
@@ -72,6 +73,7 @@ int main(int argc, char**argv){
   printf("USING ALLOCATOR: %s\n", ALLOCATOR_NAME);
 	int status, local_pid, i=0;
 	unsigned long long exec_time;
+	struct rusage usage;
 	unsigned long long total_fail = 0, total_alloc = 0, total_free = 0, total_ops = 0;
 	unsigned long long total_mem = 0;
 	
@@ -101,6 +103,8 @@ int main(int argc, char**argv){
 	}
 	
 	printf("Timer  (clocks): %llu\n",clock_timer_value(exec_time));
+	getrusage(RUSAGE_SELF, &usage);
+	printf("Max RSS    (KB): %ld\n", usage.ru_maxrss);
 	
 	   
 		
@@ -0,0 +1,69 @@
+#include "parameters.h"
+
+void* bd_xx_malloc(size_t);
+void  bd_xx_free(void*);
+
+#ifdef REALLOC_API
+void* bd_xx_realloc(void*, size_t);
+#define TO_BE_REPLACED_REALLOC(p,x,o) bd_xx_realloc(p,x)
+#else
+/*
+ Without a realloc the buffer is moved by hand, as the users of the allocator would do.
+ */
+static inline void* realloc_by_copy(void *p, size_t size, size_t old_size){
+	void *q = TO_BE_REPLACED_MALLOC(size);
+	if(q != NULL && p != NULL){
+		memcpy(q, p, old_size < size ? old_size : size);
+		TO_BE_REPLACED_FREE(p);
+	}
+	return q;
+}
+#define TO_BE_REPLACED_REALLOC(p,x,o) realloc_by_copy(p,x,o)
+#endif
+
+/*
+ Every thread repeatedly builds a buffer of fixed_size bytes and doubles it RA_STEPS times, writing the new half
+ after each step, as a growing vector or string builder would; then it halves it back to fixed_size and releases it.
+ A resize that returns the same address has been served in place.
+ */
+void grow(unsigned long long fixed_size, unsigned long long *allocs, unsigned long long *failures, unsigned long long *frees, unsigned long long *inplace, unsigned long long *moved){
+	unsigned long long i, size;
+	unsigned int s;
+	char *buf, *obt;
+
+	for(i=0;i<RA_ITERATIONS;i++){
+		buf = TO_BE_REPLACED_MALLOC(fixed_size);
+		if(buf == NULL){
+			(*failures)++;
+			continue;
+		}
+		(*allocs)++;
+		memset(buf, 1, fixed_size);
+
+		for(s=0, size=fixed_size;s<RA_STEPS;s++, size<<=1){
+			obt = TO_BE_REPLACED_REALLOC(buf, size << 1, size);
+			if(obt == NULL){
+				(*failures)++;
+				break;
+			}
+			if(obt == buf)	(*inplace)++;
+			else			(*moved)++;
+			buf = obt;
+			memset(buf + size, 1, size);
+		}
+
+		for(;s>0;s--, size>>=1){
+			obt = TO_BE_REPLACED_REALLOC(buf, size >> 1, size);
+			if(obt == NULL){
+				(*failures)++;
+				break;
+			}
+			if(obt == buf)	(*inplace)++;
+			else			(*moved)++;
+			buf = obt;
+		}
+
+		TO_BE_REPLACED_FREE(buf);
+		(*frees)++;
+	}
+}
@@ -0,0 +1,7 @@
+#ifndef __RA_PARAMETERS__
+#define __RA_PARAMETERS__
+
+#define RA_ITERATIONS	200000ULL
+#define RA_STEPS		6		//a buffer grows from mem size to mem size << RA_STEPS and back
+
+#endif
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <pthread.h>
+#include <string.h>
+#include "utils.h"
+#include "timer.h"
+
+
+unsigned int number_of_processes;
+unsigned int pcount = 0;
+__thread unsigned int myid=0;
+
+static unsigned long long *volatile failures, *volatile allocs, *volatile frees, *volatile corrupted;
+unsigned int *start;
+
+unsigned long long max_size;
+
+#include "parameters.h"
+
+#if KERNEL_BD == 0
+#include "main.h"
+#endif
+
+
+void * init_run(){
+	//child code, do work and exit.
+	myid = __sync_fetch_and_add(&pcount, 1);
+
+	while(__atomic_load_n(start, __ATOMIC_ACQUIRE)==0);
+#if KERNEL_BD == 0
+	stress(max_size, myid, allocs+myid, failures+myid, frees+myid, corrupted+myid);
+#endif
+	pthread_exit(NULL);
+}
+
+
+__attribute__((constructor(400))) void pre_main2(int argc, char**argv){
+	unsigned int i;
+	number_of_processes=atoi(argv[1]);
+	failures = mmap(NULL, sizeof(unsigned long long) * number_of_processes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	allocs = mmap(NULL, sizeof(unsigned long long) * number_of_processes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	frees = mmap(NULL, sizeof(unsigned long long) * number_of_processes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	corrupted = mmap(NULL, sizeof(unsigned long long) * number_of_processes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	start = mmap(NULL, sizeof(unsigned int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	*start = 0;
+	for(i=0; i<number_of_processes; i++){
+		allocs[i] = frees[i] = failures[i] = corrupted[i] = 0;
+	}
+}
+
+
+int main(int argc, char**argv){
+  printf("USING ALLOCATOR: %s\n", ALLOCATOR_NAME);
+	int i=0;
+	unsigned long long exec_time;
+	unsigned long long total_fail = 0, total_alloc = 0, total_free = 0, total_corrupted = 0;
+
+	if(argc!=3){
+		printf("usage: ./a.out <number of threads> <mem size>\n");
+		exit(0);
+	}
+#if KERNEL_BD == 1
+	printf("stress is not available for the kernel buddy system\n");
+	exit(0);
+#endif
+	number_of_processes = atoi(argv[1]);
+	max_size = atoll(argv[2]);
+	printf("Avvio stress test con blocchi da %llu a %llu byte e %llu operazioni per thread\n", (max_size >> (ST_ORDERS-1))/2 + 1, max_size, ST_ITERATIONS);
+	pthread_t p_tid[number_of_processes];
+	for(i=0; i<number_of_processes; i++){
+		if( (pthread_create(&p_tid[i], NULL, init_run, NULL)) != 0) {
+            fprintf(stderr, "%s\n", strerror(errno));
+            abort();
+        }
+	}
+	clock_timer_start(exec_time);
+	__sync_fetch_and_add(start,1);
+
+
+	for(i = 0; i < number_of_processes; i++){
+		pthread_join(p_tid[i], NULL);
+	}
+#if KERNEL_BD == 0
+	stress_drain(frees);
+#endif
+
+	printf("Timer  (clocks): %llu\n",clock_timer_value(exec_time));
+
+	printf("_______________________________________\n");
+	for(i=0;i<number_of_processes;i++){
+		printf("[%d]: TOT_OPS      %10llu: ",i, allocs[i]+frees[i]+failures[i]);
+		printf("\t allocati: %10llu ;", allocs[i]);
+		printf("\t dealloca: %10llu ;", frees[i]);
+		printf("\t failures: %10llu ;", failures[i]);
+		printf("\t corrotti: %10llu \n", corrupted[i]);
+		total_fail += failures[i];
+		total_alloc += allocs[i];
+		total_free += frees[i];
+		total_corrupted += corrupted[i];
+	}
+	printf("_______________________________________\n");
+	printf("total allocs:     %10llu\n", total_alloc);
+	printf("total frees:  	  %10llu\n", total_free);
+	printf("       diff:  	  %10llu\n", total_alloc-total_free);
+	printf("............................\n");
+	printf("total failures:   %10llu\n", total_fail);
+	printf("total corrupted:  %10llu\n", total_corrupted);
+
+	return total_corrupted != 0;
+}
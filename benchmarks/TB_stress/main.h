@@ -0,0 +1,86 @@
+#include "parameters.h"
+
+void* bd_xx_malloc(size_t);
+void  bd_xx_free(void*);
+
+static void *handoff[ST_HANDOFF];
+
+
+/*
+ Returns the size of a request of at most max_size bytes. The power of two serving it is chosen among the ST_ORDERS
+ below max_size, each one twice as often as the next larger one, so that every order takes about the same bytes;
+ the size is then drawn in the upper half of it, so that most requests are not powers of two.
+ */
+static inline unsigned long long stress_size(unsigned long long max_size, unsigned int *seed){
+	unsigned long long size = max_size >> (ST_ORDERS - 1 - __builtin_ctz(rand_r(seed) | (1U << (ST_ORDERS - 1))));
+
+	if(size == 0)
+		size = 1;
+	return size/2 + 1 + rand_r(seed) % (size - size/2);
+}
+
+/*
+ Every thread holds up to ST_SLOTS blocks of random size (see stress_size), filled with a byte of its own.
+ At each step it either takes a new block or checks the content of one it holds and gives it back:
+ a block handed out twice, or a block still in use when it was released, shows up as a wrong byte.
+ One block out of eight is passed through the handoff array instead, and released by whichever thread picks it up.
+ */
+void stress(unsigned long long max_size, unsigned int id, unsigned long long *allocs, unsigned long long *failures, unsigned long long *frees, unsigned long long *corrupted){
+	unsigned long long i, j, size[ST_SLOTS];
+	unsigned int seed = id*7+1, n = 0, k;
+	unsigned char tag = id+1, *slot[ST_SLOTS];
+	void *obt;
+
+	for(i=0;i<ST_ITERATIONS;i++){
+		if(n < ST_SLOTS && (n == 0 || (rand_r(&seed) & 1))){
+			size[n] = stress_size(max_size, &seed);
+			slot[n] = TO_BE_REPLACED_MALLOC(size[n]);
+			if(slot[n] == NULL){
+				(*failures)++;
+				continue;
+			}
+			memset(slot[n], tag, size[n]);
+			(*allocs)++;
+			n++;
+			continue;
+		}
+
+		k = rand_r(&seed) % n;
+		for(j=0;j<size[k];j++){
+			if(slot[k][j] != tag){
+				(*corrupted)++;
+				break;
+			}
+		}
+
+		obt = slot[k];
+		if((rand_r(&seed) & 7) == 0)
+			obt = __atomic_exchange_n(&handoff[rand_r(&seed) % ST_HANDOFF], obt, __ATOMIC_ACQ_REL);
+		if(obt != NULL){
+			TO_BE_REPLACED_FREE(obt);
+			(*frees)++;
+		}
+		slot[k] = slot[--n];
+		size[k] = size[n];
+	}
+
+	for(k=0;k<n;k++){
+		TO_BE_REPLACED_FREE(slot[k]);
+		(*frees)++;
+	}
+}
+
+
+/*
+ Releases the blocks left in the handoff array.
+ */
+void stress_drain(unsigned long long *frees){
+	unsigned int k;
+
+	for(k=0;k<ST_HANDOFF;k++){
+		if(handoff[k] != NULL){
+			TO_BE_REPLACED_FREE(handoff[k]);
+			(*frees)++;
+		}
+	}
+}
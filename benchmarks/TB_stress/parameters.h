@@ -0,0 +1,24 @@
+#ifndef __ST_PARAMETERS__
+#define __ST_PARAMETERS__
+
+#ifndef ST_ITERATIONS
+#ifdef __SANITIZE_THREAD__
+#define ST_ITERATIONS	50000ULL		//ThreadSanitizer slows down every access to the blocks
+#else
+#define ST_ITERATIONS	1000000ULL
+#endif
+#endif
+
+#ifndef ST_SLOTS
+#define ST_SLOTS		64		//blocks held by each thread
+#endif
+
+#ifndef ST_ORDERS
+#define ST_ORDERS		12		//sizes from mem size >> (ST_ORDERS-1) to mem size
+#endif
+
+#ifndef ST_HANDOFF
+#define ST_HANDOFF		64		//blocks passed among the threads
+#endif
+
+#endif
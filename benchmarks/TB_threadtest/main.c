@@ -24,6 +24,7 @@ unsigned int *start;
 
 unsigned long long fixed_size;
 unsigned int fixed_order;
+unsigned int batch = 0;
 
 
 #if KERNEL_BD == 0
@@ -38,10 +39,13 @@ void * init_run(){
 	//child code, do work and exit.
 	myid = __sync_fetch_and_add(&pcount, 1);//myid = getpid() % number_of_processes;// 	
 	
-	while(*start==0);
+	while(__atomic_load_n(start, __ATOMIC_ACQUIRE)==0);
 #if KERNEL_BD == 0
 	ops[myid] = TT_ITERATIONS * TT_OBJS / number_of_processes;
-	threadtest(fixed_size, number_of_processes, allocs+myid, failures+myid, frees+myid);
+	if(batch > 0)
+		threadtest_batch(fixed_size, batch, number_of_processes, allocs+myid, failures+myid, frees+myid);
+	else
+		threadtest(fixed_size, number_of_processes, allocs+myid, failures+myid, frees+myid);
 #else	
 	unsigned long nodemask = 0x01;
 	set_mempolicy(MPOL_BIND, &nodemask,sizeof(unsigned long));
@@ -75,12 +79,19 @@ int main(int argc, char**argv){
 	unsigned long long total_mem = 0;
 	
 	
-	if(argc!=3){
-		printf("usage: ./a.out <number of threads> <mem size>\n");
+	if(argc!=3 && argc!=4){
+		printf("usage: ./a.out <number of threads> <mem size> [<batch size>]\n");
 		exit(0);
 	}
 	number_of_processes = atoi(argv[1]);
 	fixed_size = atoll(argv[2]);
+	if(argc==4) batch = atoi(argv[3]);
+#if KERNEL_BD == 1
+	if(batch > 0){
+		printf("batch mode is not available for %s\n", ALLOCATOR_NAME);
+		exit(0);
+	}
+#endif
 	fixed_order = convert_to_level(fixed_size);
 	
 	pthread_t p_tid[number_of_processes];    
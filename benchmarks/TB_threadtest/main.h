@@ -13,6 +13,30 @@ void  bd_xx_free(FREE_GET_PAR(void*,size_t));
 
 #include "parameters.h"
 
+#if KERNEL_BD == 0
+#ifdef BULK_API
+unsigned int bd_xx_malloc_bulk(size_t, unsigned int, void**);
+void bd_xx_free_bulk(void**, unsigned int);
+#define TO_BE_REPLACED_MALLOC_BULK(x,n,o) bd_xx_malloc_bulk(x,n,o)
+#define TO_BE_REPLACED_FREE_BULK(p,n) bd_xx_free_bulk(p,n)
+#else
+static inline unsigned int malloc_bulk(size_t size, unsigned int count, void **out){
+	unsigned int i, got = 0;
+	for(i=0;i<count;i++)
+		if((out[got] = TO_BE_REPLACED_MALLOC(size)) != NULL)
+			got++;
+	return got;
+}
+static inline void free_bulk(void **ptrs, unsigned int count){
+	unsigned int i;
+	for(i=0;i<count;i++)
+		TO_BE_REPLACED_FREE(ptrs[i]);
+}
+#define TO_BE_REPLACED_MALLOC_BULK(x,n,o) malloc_bulk(x,n,o)
+#define TO_BE_REPLACED_FREE_BULK(p,n) free_bulk(p,n)
+#endif
+#endif
+
 
 void threadtest(ALLOC_GET_PAR(unsigned long long fixed_size, unsigned int fixed_order), unsigned int number_of_processes, unsigned long long *allocs, unsigned long long *failures, unsigned long long *frees){
 	unsigned int i, j, tentativi = TT_OBJS / number_of_processes;
@@ -54,3 +78,33 @@ void threadtest(ALLOC_GET_PAR(unsigned long long fixed_size, unsigned int fixed_
 	vfree(addrs);
 #endif
 }
+
+#if KERNEL_BD == 0
+/*
+ Same as threadtest, but blocks are requested and released batch at a time through the bulk API.
+ */
+void threadtest_batch(unsigned long long fixed_size, unsigned int batch, unsigned int number_of_processes, unsigned long long *allocs, unsigned long long *failures, unsigned long long *frees){
+	unsigned int i, j, k, n, got, tentativi = TT_OBJS / number_of_processes;
+	unsigned int iterations = TT_ITERATIONS;
+	void **addrs = malloc(sizeof(void*)*tentativi);
+	tentativi /= fixed_size/BASE;
+	iterations *= fixed_size/BASE;
+
+	for(j=0; j<iterations; j++){
+		for(i=0, k=0; i<tentativi; i+=n){
+			n = tentativi - i < batch ? tentativi - i : batch;
+			got = TO_BE_REPLACED_MALLOC_BULK(fixed_size, n, addrs+k);
+			k += got;
+			(*allocs) += got;
+			(*failures) += n - got;
+		}
+		
+		for(i=0; i<k; i+=n){
+			n = k - i < batch ? k - i : batch;
+			TO_BE_REPLACED_FREE_BULK(addrs+i, n);
+			(*frees) += n;
+		}
+	}
+	free(addrs);
+}
+#endif
@@ -1,15 +1,21 @@
 BASE_ALLOCATORS = $(abspath ../../allocators)
 
 PATH_ALLOCATORS = $(subst $(BASE_ALLOCATORS)/Makefile,  , $(wildcard $(BASE_ALLOCATORS)/*))
-ALLOCATORS = $(filter-out Makefile nballoc.mk hoard 1lvl-ll, $(subst $(BASE_ALLOCATORS)/,  ,  $(PATH_ALLOCATORS))) kernel-sl
+ALLOCATORS = $(filter-out Makefile nballoc.mk %.h %.c hoard 1lvl-ll, $(subst $(BASE_ALLOCATORS)/,  ,  $(PATH_ALLOCATORS))) kernel-sl
 INTERMEDIATE_OBJS_PATH = bin
 MY_ALLOCATORS = 1lvl-nb 1lvl-sl 4lvl-nb 4lvl-sl buddy-sl
+BULK_ALLOCATORS = 1lvl-nb 1lvl-sl 4lvl-nb 4lvl-sl
+REALLOC_ALLOCATORS = 1lvl-nb 1lvl-sl 4lvl-nb 4lvl-sl
 
 CC=gcc
 CFLAGS= -I$(BASE_ALLOCATORS)/$* -I../../utils 
 
 LIBRARY = -lpthread
 
+ifdef TSAN
+FLAGS :=$(FLAGS) -fsanitize=thread
+endif
+
 SRCS = main.c main.h parameters.h ../../kernel-bd-api/syscall_numbers.h
 
 .SECONDARY:
@@ -21,7 +27,7 @@ $(INTERMEDIATE_OBJS_PATH):
 
 $(TARGET)-%-nb: $(SRCS) #$(BASE_ALLOCATORS)/$(TARGET)-%-nb/nballoc.o
 	@echo compiling for $@
-	$(CC) $(FLAGS) main.c  -I../../utils  -I$(abspath ../../allocators/$*-nb) -L$(abspath ../../allocators/$*-nb) -l$*-nb  -o $(TARGET)-$*-nb -DALLOCATOR=$*-nb -D'TO_BE_REPLACED_MALLOC(x)=bd_xx_malloc(x)' -D'TO_BE_REPLACED_FREE(x)=bd_xx_free(x)' -lpthread -D'ALLOCATOR_NAME="$*-nb"'
+	$(CC) $(FLAGS) main.c  -I../../utils  -I$(abspath ../../allocators/$*-nb) -L$(abspath ../../allocators/$*-nb) -l$*-nb  -o $(TARGET)-$*-nb $(if $(filter $*-nb,$(BULK_ALLOCATORS)),-DBULK_API) $(if $(filter $*-nb,$(REALLOC_ALLOCATORS)),-DREALLOC_API) -DALLOCATOR=$*-nb -D'TO_BE_REPLACED_MALLOC(x)=bd_xx_malloc(x)' -D'TO_BE_REPLACED_FREE(x)=bd_xx_free(x)' -lpthread -D'ALLOCATOR_NAME="$*-nb"'
 
 $(TARGET)-kernel-sl:  $(SRCS)
 	@echo compiling for $@
@@ -29,7 +35,7 @@ $(TARGET)-kernel-sl:  $(SRCS)
 
 $(TARGET)-%-sl:  $(SRCS)
 	@echo compiling for $@
-	$(CC) $(FLAGS) main.c  -I../../utils  -I$(abspath ../../allocators/$*-sl) -L$(abspath ../../allocators/$*-sl) -l$*-sl -o $(TARGET)-$*-sl -DALLOCATOR=$*-sl -D'TO_BE_REPLACED_MALLOC(x)=bd_xx_malloc(x)' -D'TO_BE_REPLACED_FREE(x)=bd_xx_free(x)' -lpthread -D'ALLOCATOR_NAME="$*-sl"'
+	$(CC) $(FLAGS) main.c  -I../../utils  -I$(abspath ../../allocators/$*-sl) -L$(abspath ../../allocators/$*-sl) -l$*-sl -o $(TARGET)-$*-sl $(if $(filter $*-sl,$(BULK_ALLOCATORS)),-DBULK_API) $(if $(filter $*-sl,$(REALLOC_ALLOCATORS)),-DREALLOC_API) -DALLOCATOR=$*-sl -D'TO_BE_REPLACED_MALLOC(x)=bd_xx_malloc(x)' -D'TO_BE_REPLACED_FREE(x)=bd_xx_free(x)' -lpthread -D'ALLOCATOR_NAME="$*-sl"'
 
 $(TARGET)-%: $(TARGET)-%.o  #$(BASE_ALLOCATORS)/%/nballoc.o
 	@echo linking $* $(TARGET)-$*.o $(BASE_ALLOCATORS)/$*/nballoc.o ../../utils/utils.o
@@ -5,6 +5,7 @@ RUN_list="1 2 3 4"					# run list
 ALLOC_list="1lvl-nb 4lvl-nb"        # kernel-sl # list of allocators
 SIZE_list="4096 32768 262144"
 TEST_list="TBTT TBLS TBFS TBCA"
+PADDED_list="4 8 12 16 24"			# padded levels of the 1lvl tree for padding_tradeoff.sh
 
 NUM_LEVELS=24
 MAX=4194304
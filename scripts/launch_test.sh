@@ -2,8 +2,12 @@
 
 source config.sh
 
-make clean
-make NUM_LEVELS=${NUM_LEVELS} MAX=${MAX} MIN=${MIN}
+make
+
+# the shape of the heap is read at startup, so no rebuild is needed
+export NBBS_NUM_LEVELS=${NUM_LEVELS}
+export NBBS_MAX=${MAX}
+export NBBS_MIN=${MIN}
 
 mkdir -p ${FOLDER}
 
@@ -0,0 +1,38 @@
+#!/bin/bash
+
+# Runs TB_linux-scalability and TB_fixed-size on 1lvl-nb for each value of
+# PADDED_list and prints, for each run, the clocks and the peak RSS.
+
+cd `dirname $0`
+source config.sh
+cd ..
+
+make
+
+export NBBS_NUM_LEVELS=${NUM_LEVELS}
+export NBBS_MAX=${MAX}
+export NBBS_MIN=${MIN}
+
+printf "%-6s %-8s %-8s %-8s %16s %12s\n" test padded threads size clocks maxrss_kb
+
+for padded in $PADDED_list
+do
+	export NBBS_PADDED_LEVELS=$padded
+	for size in $SIZE_list
+	do
+		for threads in $THREAD_list
+		do
+			for test in TB_linux-scalability TB_fixed-size
+			do
+				out=`./benchmarks/$test/$test-1lvl-nb $threads $size`
+				clocks=`echo "$out" | grep "Timer" | awk '{print $NF}'`
+				rss=`echo "$out" | grep "Max RSS" | awk '{print $NF}'`
+				case $test in
+					TB_linux-scalability) name=TBLS;;
+					TB_fixed-size) name=TBFS;;
+				esac
+				printf "%-6s %-8s %-8s %-8s %16s %12s\n" $name $padded $threads $size $clocks $rss
+			done
+		done
+	done
+done
@@ -1,7 +1,7 @@
 #include <stdlib.h>
 #include "utils.h"
 
-__thread unsigned int freemap[128];
+__thread unsigned long long freemap[128];
 
 unsigned int rand_lim(unsigned int limit) {
     /* return a random number between 0 and limit inclusive.
@@ -16,3 +16,20 @@ unsigned int rand_lim(unsigned int limit) {
     
     return retval;
 }
+
+unsigned long long getenv_ull(const char *name, unsigned long long def) {
+    /* return the value of the environment variable name if it is set to a
+     * valid number, def otherwise.
+     */
+    char *str = getenv(name), *end;
+    unsigned long long retval;
+    
+    if(str == NULL || *str == '\0')
+        return def;
+    
+    retval = strtoull(str, &end, 0);
+    if(*end != '\0')
+        return def;
+    
+    return retval;
+}
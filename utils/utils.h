@@ -9,16 +9,17 @@
     
 
 unsigned int rand_lim(unsigned int limit);
+unsigned long long getenv_ull(const char *name, unsigned long long def);
 //unsigned long upper_power_of_two(unsigned long v);
 //unsigned int log2_ (unsigned long value);
 //int convert_to_level(unsigned long long size);
 
 #define ENABLE_CACHE 1
 
-extern __thread unsigned int freemap[];
+extern __thread unsigned long long freemap[];
 
-static inline void update_freemap(unsigned int key, unsigned int value){
-    unsigned int tmp = 
+static inline void update_freemap(unsigned int key, unsigned long long value){
+    unsigned long long tmp = 
   #if ENABLE_CACHE == 1
     freemap[key];
   #else
@@ -28,11 +29,11 @@ static inline void update_freemap(unsigned int key, unsigned int value){
 freemap[key] = value;
 }
 
-static inline unsigned int get_freemap(unsigned int key, unsigned int max){
+static inline unsigned long long get_freemap(unsigned int key, unsigned long long max){
   #if ENABLE_CACHE == 0
      return 0;
   #endif
-     unsigned int tmp = freemap[key];
+     unsigned long long tmp = freemap[key];
      freemap[key] += freemap[key] != 0;
      freemap[key] = (-(freemap[key]<max)) & freemap[key];
      return tmp;
@@ -43,7 +44,7 @@ static inline unsigned int get_freemap(unsigned int key, unsigned int max){
 
 
 static inline unsigned long upper_power_of_two(unsigned long v){
-    v--; v |= v >> 1; v |= v >> 2; v |= v >> 4; v |= v >> 8; v |= v >> 16; v++;
+    v--; v |= v >> 1; v |= v >> 2; v |= v >> 4; v |= v >> 8; v |= v >> 16; v |= v >> 32; v++;
     return v;
 }
 
@@ -72,6 +73,38 @@ static inline unsigned int log2_ (unsigned long value){
 
 
 
+/* heapsort in descending order, it does not allocate memory. Already sorted and reversed arrays take a linear pass */
+static inline void sort_desc_ull(unsigned long long *v, unsigned long long n){
+    unsigned long long i, root, child, tmp, end = n;
+    
+    if(n < 2) return;
+    for(i = 1; i < n && v[i-1] >= v[i]; i++);
+    if(i == n) return;
+    for(i = 1; i < n && v[i-1] <= v[i]; i++);
+    if(i == n){
+        for(i = 0; i < n/2; i++){
+            tmp = v[i]; v[i] = v[n-1-i]; v[n-1-i] = tmp;
+        }
+        return;
+    }
+    for(i = n/2; i-- > 0; ){
+        for(root = i; (child = 2*root+1) < n; root = child){
+            if(child+1 < n && v[child+1] < v[child]) child++;
+            if(v[root] <= v[child]) break;
+            tmp = v[root]; v[root] = v[child]; v[child] = tmp;
+        }
+    }
+    while(--end > 0){
+        tmp = v[0]; v[0] = v[end]; v[end] = tmp;
+        for(root = 0; (child = 2*root+1) < end; root = child){
+            if(child+1 < end && v[child+1] < v[child]) child++;
+            if(v[root] <= v[child]) break;
+            tmp = v[root]; v[root] = v[child]; v[child] = tmp;
+        }
+    }
+}
+
+
 static inline int convert_to_level(unsigned long long size){
 	unsigned long long tmp = (size - 1)/PAGE_SIZE + 1;
 	return (int) log2_(tmp);	